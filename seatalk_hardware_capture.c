@@ -0,0 +1,72 @@
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include "seatalk_hardware_gpio.h"
+
+// Edge capture
+// Turns the driver into a logic analyser for the bus. With edge_capture set the RxD IRQ fires on both edges and
+// every one is recorded, with the level the line went to, in a ring mapped read-only into userspace (see
+// struct seatalk_edge_ring). With edge_capture_tx also set, every change in the level we drive on TxD is recorded
+// too. Decoding carries on as normal alongside.
+//
+// Recording an edge is a store and a counter update. The ring is overwritten when full: the driver never waits
+// for readers, who use the head count to tell which edges they missed (see seatalk_edges_read()).
+
+bool seatalk_edge_capture = 0;
+module_param_named(edge_capture, seatalk_edge_capture, bool, 0444);
+MODULE_PARM_DESC(edge_capture, "Record every RxD edge in a ring that can be mapped from /dev/seatalk");
+
+bool seatalk_edge_capture_tx = 0;
+module_param_named(edge_capture_tx, seatalk_edge_capture_tx, bool, 0644);
+MODULE_PARM_DESC(edge_capture_tx, "Also record the levels driven on TxD when edge_capture is set");
+
+static struct seatalk_edge_ring *edge_ring;
+// RxD edges come from the IRQ handler and TxD levels from the transmit timer, possibly on another CPU
+static DEFINE_SPINLOCK(edge_lock);
+
+void seatalk_capture_edge(u64 timestamp_ns, int level, int tx) {
+  unsigned long flags;
+  u64 head;
+
+  if (!edge_ring) {
+    return;
+  }
+  spin_lock_irqsave(&edge_lock, flags);
+  head = edge_ring->head;
+  // readers must never see the slot change without also being able to see the head that says it may
+  smp_wmb();
+  edge_ring->edges[head % SEATALK_EDGE_ENTRIES] = (timestamp_ns << SEATALK_EDGE_FLAG_BITS) | (tx ? SEATALK_EDGE_TX : 0) | (level ? SEATALK_EDGE_LEVEL : 0);
+  smp_store_release(&edge_ring->head, head + 1);
+  spin_unlock_irqrestore(&edge_lock, flags);
+}
+
+int seatalk_capture_mmap(struct vm_area_struct *vma) {
+  if (!edge_ring) {
+    return -ENODEV;
+  }
+  if (vma->vm_flags & VM_WRITE) {
+    return -EPERM;
+  }
+  vm_flags_clear(vma, VM_MAYWRITE);
+  return remap_vmalloc_range(vma, edge_ring, 0);
+}
+
+int seatalk_capture_init(void) {
+  if (!seatalk_edge_capture) {
+    return 0;
+  }
+  // vmalloc_user gives zeroed pages that can be mapped into userspace
+  edge_ring = vmalloc_user(PAGE_ALIGN(SEATALK_EDGE_RING_SIZE));
+  if (!edge_ring) {
+    pr_info("Unable to allocate edge capture ring");
+    return -1;
+  }
+  return 0;
+}
+
+void seatalk_capture_exit(void) {
+  vfree(edge_ring);
+  edge_ring = NULL;
+}
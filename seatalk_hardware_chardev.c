@@ -0,0 +1,277 @@
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/kfifo.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/refcount.h>
+#include <linux/capability.h>
+#include "seatalk_hardware_gpio.h"
+
+// /dev/seatalk hands received datagrams to userspace.
+// Each open file has its own queue and its own command byte filter. The filter is checked when the
+// datagram is delivered (in timer context) so a reader is only woken for datagrams it asked for.
+// Each open file also has a completion ring for the datagrams it submits with SEATALK_IOC_SUBMIT. Datagrams can
+// still be waiting to go after the file is closed, so the reader is reference counted: one reference for the
+// open file and one for every submitted datagram not yet completed.
+
+// number of datagrams queued per open file before new ones are dropped
+#define READER_QUEUE_LENGTH 64
+
+struct seatalk_reader {
+  struct list_head list;
+  // protected by readers_lock
+  struct seatalk_command_filter filter;
+  unsigned long overruns;
+  // single producer (seatalk_chardev_deliver under readers_lock), single consumer (read under read_mutex)
+  DECLARE_KFIFO(queue, struct seatalk_datagram_record, READER_QUEUE_LENGTH);
+  struct mutex read_mutex;
+  wait_queue_head_t wait;
+  // mapped into userspace, which may scribble on it, so the head is kept here and only copied out
+  struct seatalk_completion_ring *completions;
+  u32 completion_head;
+  spinlock_t completion_lock;
+  refcount_t references;
+};
+
+// every open file on the device
+static LIST_HEAD(readers);
+// taken from timer context so must be held with interrupts disabled
+static DEFINE_SPINLOCK(readers_lock);
+
+void seatalk_chardev_deliver(const struct seatalk_datagram_record *record) {
+  struct seatalk_reader *reader;
+  unsigned long flags;
+
+  spin_lock_irqsave(&readers_lock, flags);
+  list_for_each_entry(reader, &readers, list) {
+    // uninterested readers are skipped without being woken
+    if (!seatalk_command_filter_test(&reader->filter, record->bytes[0])) {
+      continue;
+    }
+    if (kfifo_put(&reader->queue, *record)) {
+      wake_up_interruptible(&reader->wait);
+    } else {
+      // reader is not keeping up. Drop the newest datagram rather than block the receiver
+      reader->overruns++;
+    }
+  }
+  spin_unlock_irqrestore(&readers_lock, flags);
+}
+
+static void put_reader(struct seatalk_reader *reader) {
+  if (refcount_dec_and_test(&reader->references)) {
+    // may be the last completion: in timer context, or under tx_lock with interrupts off when a queued datagram is
+    // coalesced away. vfree may sleep there, so leave freeing the ring to a worker
+    vfree_atomic(reader->completions);
+    kfree(reader);
+  }
+}
+
+// a submitted datagram has gone (or failed). Called from the transmitter, possibly in timer context
+static void seatalk_tx_completed(const struct seatalk_tx_completion *completion, void *context) {
+  struct seatalk_reader *reader = context;
+  struct seatalk_completion_ring *ring = reader->completions;
+  unsigned long flags;
+
+  spin_lock_irqsave(&reader->completion_lock, flags);
+  if (reader->completion_head - READ_ONCE(ring->tail) >= SEATALK_COMPLETION_ENTRIES) {
+    ring->overruns++;
+  } else {
+    ring->entries[reader->completion_head % SEATALK_COMPLETION_ENTRIES] = *completion;
+    reader->completion_head++;
+    // entry must be visible before the new head
+    smp_store_release(&ring->head, reader->completion_head);
+  }
+  spin_unlock_irqrestore(&reader->completion_lock, flags);
+  wake_up_interruptible(&reader->wait);
+  put_reader(reader);
+}
+
+static int seatalk_open(struct inode *inode, struct file *file) {
+  struct seatalk_reader *reader;
+  unsigned long flags;
+
+  reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+  if (!reader) {
+    return -ENOMEM;
+  }
+  // vmalloc_user gives zeroed pages that can be mapped into userspace
+  reader->completions = vmalloc_user(PAGE_ALIGN(SEATALK_COMPLETION_RING_SIZE));
+  if (!reader->completions) {
+    kfree(reader);
+    return -ENOMEM;
+  }
+  INIT_KFIFO(reader->queue);
+  mutex_init(&reader->read_mutex);
+  init_waitqueue_head(&reader->wait);
+  spin_lock_init(&reader->completion_lock);
+  refcount_set(&reader->references, 1);
+  // receive everything until told otherwise
+  memset(&reader->filter, 0xff, sizeof(reader->filter));
+  file->private_data = reader;
+
+  spin_lock_irqsave(&readers_lock, flags);
+  list_add_tail(&reader->list, &readers);
+  spin_unlock_irqrestore(&readers_lock, flags);
+  // datagrams are a stream; there is nothing to seek
+  return stream_open(inode, file);
+}
+
+static int seatalk_release(struct inode *inode, struct file *file) {
+  struct seatalk_reader *reader = file->private_data;
+  unsigned long flags;
+
+  spin_lock_irqsave(&readers_lock, flags);
+  list_del(&reader->list);
+  spin_unlock_irqrestore(&readers_lock, flags);
+  put_reader(reader);
+  return 0;
+}
+
+// returns whole struct seatalk_datagram_record entries only
+static ssize_t seatalk_read(struct file *file, char __user *buffer, size_t count, loff_t *offset) {
+  struct seatalk_reader *reader = file->private_data;
+  unsigned int copied;
+  int result;
+
+  if (count < sizeof(struct seatalk_datagram_record)) {
+    return -EINVAL;
+  }
+  if (mutex_lock_interruptible(&reader->read_mutex)) {
+    return -ERESTARTSYS;
+  }
+  while (kfifo_is_empty(&reader->queue)) {
+    mutex_unlock(&reader->read_mutex);
+    if (file->f_flags & O_NONBLOCK) {
+      return -EAGAIN;
+    }
+    if (wait_event_interruptible(reader->wait, !kfifo_is_empty(&reader->queue))) {
+      return -ERESTARTSYS;
+    }
+    if (mutex_lock_interruptible(&reader->read_mutex)) {
+      return -ERESTARTSYS;
+    }
+  }
+  result = kfifo_to_user(&reader->queue, buffer, count, &copied);
+  mutex_unlock(&reader->read_mutex);
+  return result ? result : copied;
+}
+
+static __poll_t seatalk_poll(struct file *file, poll_table *wait) {
+  struct seatalk_reader *reader = file->private_data;
+
+  __poll_t mask = 0;
+
+  poll_wait(file, &reader->wait, wait);
+  if (!kfifo_is_empty(&reader->queue)) {
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+  if (READ_ONCE(reader->completion_head) != READ_ONCE(reader->completions->tail)) {
+    mask |= EPOLLPRI;
+  }
+  return mask;
+}
+
+static long seatalk_submit(struct seatalk_reader *reader, struct seatalk_tx_batch __user *argument) {
+  struct seatalk_tx_batch batch;
+  struct seatalk_tx_request *requests;
+
+  if (copy_from_user(&batch, argument, sizeof(batch))) {
+    return -EFAULT;
+  }
+  if (!batch.count || batch.count > SEATALK_TX_BATCH_MAX) {
+    return -EINVAL;
+  }
+  requests = memdup_user(u64_to_user_ptr(batch.requests), batch.count * sizeof(*requests));
+  if (IS_ERR(requests)) {
+    return PTR_ERR(requests);
+  }
+  // every request is completed exactly once and each completion drops a reference
+  refcount_add(batch.count, &reader->references);
+  batch.queued = seatalk_submit_batch(requests, batch.count, seatalk_tx_completed, reader);
+  kfree(requests);
+  return put_user(batch.queued, &argument->queued);
+}
+
+static long seatalk_ioctl(struct file *file, unsigned int command, unsigned long argument) {
+  struct seatalk_reader *reader = file->private_data;
+  struct seatalk_command_filter filter;
+  unsigned long flags;
+
+  switch (command) {
+  case SEATALK_IOC_SET_FILTER:
+    if (copy_from_user(&filter, (void __user *)argument, sizeof(filter))) {
+      return -EFAULT;
+    }
+    spin_lock_irqsave(&readers_lock, flags);
+    reader->filter = filter;
+    spin_unlock_irqrestore(&readers_lock, flags);
+    return 0;
+  case SEATALK_IOC_GET_FILTER:
+    spin_lock_irqsave(&readers_lock, flags);
+    filter = reader->filter;
+    spin_unlock_irqrestore(&readers_lock, flags);
+    return copy_to_user((void __user *)argument, &filter, sizeof(filter)) ? -EFAULT : 0;
+  case SEATALK_IOC_SUBMIT:
+    // the same rule as sending through generic netlink: anyone who can open the device may listen, but putting
+    // datagrams on the bus (autopilot commands among them) needs CAP_NET_ADMIN
+    if (!capable(CAP_NET_ADMIN)) {
+      return -EPERM;
+    }
+    return seatalk_submit(reader, (struct seatalk_tx_batch __user *)argument);
+  default:
+    return -ENOTTY;
+  }
+}
+
+// the mmap offset selects what is mapped
+static int seatalk_mmap(struct file *file, struct vm_area_struct *vma) {
+  struct seatalk_reader *reader = file->private_data;
+
+  switch (vma->vm_pgoff << PAGE_SHIFT) {
+  case SEATALK_MMAP_LATEST_OFFSET:
+    return seatalk_latest_mmap(vma);
+  case SEATALK_MMAP_EDGES_OFFSET:
+    return seatalk_capture_mmap(vma);
+  case SEATALK_MMAP_COMPLETION_OFFSET:
+    return remap_vmalloc_range(vma, reader->completions, 0);
+  default:
+    return -EINVAL;
+  }
+}
+
+static const struct file_operations seatalk_fops = {
+  .owner = THIS_MODULE,
+  .open = seatalk_open,
+  .release = seatalk_release,
+  .read = seatalk_read,
+  .poll = seatalk_poll,
+  .unlocked_ioctl = seatalk_ioctl,
+  .mmap = seatalk_mmap,
+};
+
+static struct miscdevice seatalk_miscdev = {
+  .minor = MISC_DYNAMIC_MINOR,
+  .name = "seatalk",
+  .fops = &seatalk_fops,
+};
+
+int seatalk_chardev_init(void) {
+  if (misc_register(&seatalk_miscdev)) {
+    pr_info("Unable to register /dev/%s", seatalk_miscdev.name);
+    return -1;
+  }
+  return 0;
+}
+
+void seatalk_chardev_exit(void) {
+  misc_deregister(&seatalk_miscdev);
+}
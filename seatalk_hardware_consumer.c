@@ -0,0 +1,103 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/kfifo.h>
+#include <linux/workqueue.h>
+#include "seatalk_hardware_consumer.h"
+#include "seatalk_hardware_gpio.h"
+
+// In-kernel datagram consumers (see seatalk_hardware_consumer.h for the rules consumers must follow)
+// Immediate consumers are walked under RCU from the receive timer so delivery never takes a lock.
+// Deferred consumers share one queue and are called from a work item with consumers_mutex held, which is what
+// lets seatalk_unregister_consumer() promise the callback is not running without any further waiting.
+
+// datagrams waiting for deferred consumers
+#define DEFERRED_QUEUE_LENGTH 64
+
+// consumers_mutex serializes registration and protects deferred_consumers
+static DEFINE_MUTEX(consumers_mutex);
+static LIST_HEAD(immediate_consumers);
+static LIST_HEAD(deferred_consumers);
+// number of deferred consumers, so the receive path can skip queueing when there are none
+static int deferred_consumer_count = 0;
+
+// single producer (receive timer), single consumer (deferred_work)
+static DECLARE_KFIFO(deferred_queue, struct seatalk_datagram_record, DEFERRED_QUEUE_LENGTH);
+static void deliver_deferred(struct work_struct *work);
+static DECLARE_WORK(deferred_work, deliver_deferred);
+
+static int consumer_wants(const struct seatalk_consumer *consumer, const struct seatalk_datagram_record *record) {
+  return consumer->port == record->port && seatalk_command_filter_test(&consumer->filter, record->bytes[0]);
+}
+
+void seatalk_consumer_deliver(const struct seatalk_datagram_record *record) {
+  struct seatalk_consumer *consumer;
+
+  rcu_read_lock();
+  list_for_each_entry_rcu(consumer, &immediate_consumers, list) {
+    if (consumer_wants(consumer, record)) {
+      consumer->receive(record, consumer->context);
+    }
+  }
+  rcu_read_unlock();
+  if (READ_ONCE(deferred_consumer_count) && kfifo_put(&deferred_queue, *record)) {
+    schedule_work(&deferred_work);
+  }
+}
+
+static void deliver_deferred(struct work_struct *work) {
+  struct seatalk_datagram_record record;
+  struct seatalk_consumer *consumer;
+
+  while (kfifo_get(&deferred_queue, &record)) {
+    mutex_lock(&consumers_mutex);
+    list_for_each_entry(consumer, &deferred_consumers, list) {
+      if (consumer_wants(consumer, &record)) {
+        consumer->receive(&record, consumer->context);
+      }
+    }
+    mutex_unlock(&consumers_mutex);
+  }
+}
+
+int seatalk_register_consumer(struct seatalk_consumer *consumer) {
+  if (!consumer->receive) {
+    return -EINVAL;
+  }
+  mutex_lock(&consumers_mutex);
+  if (consumer->flags & SEATALK_CONSUMER_DEFERRED) {
+    list_add_tail(&consumer->list, &deferred_consumers);
+    WRITE_ONCE(deferred_consumer_count, deferred_consumer_count + 1);
+  } else {
+    list_add_tail_rcu(&consumer->list, &immediate_consumers);
+  }
+  mutex_unlock(&consumers_mutex);
+  return 0;
+}
+EXPORT_SYMBOL_GPL(seatalk_register_consumer);
+
+void seatalk_unregister_consumer(struct seatalk_consumer *consumer) {
+  mutex_lock(&consumers_mutex);
+  if (consumer->flags & SEATALK_CONSUMER_DEFERRED) {
+    // deliver_deferred holds consumers_mutex while calling so it cannot be mid-call
+    list_del(&consumer->list);
+    WRITE_ONCE(deferred_consumer_count, deferred_consumer_count - 1);
+    mutex_unlock(&consumers_mutex);
+    return;
+  }
+  list_del_rcu(&consumer->list);
+  mutex_unlock(&consumers_mutex);
+  // wait for any receive timer still walking the list
+  synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL(seatalk_unregister_consumer);
+
+int seatalk_consumer_init(void) {
+  INIT_KFIFO(deferred_queue);
+  return 0;
+}
+
+void seatalk_consumer_exit(void) {
+  cancel_work_sync(&deferred_work);
+}
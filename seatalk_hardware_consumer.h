@@ -0,0 +1,42 @@
+#ifndef SEATALK_HARDWARE_CONSUMER_H
+#define SEATALK_HARDWARE_CONSUMER_H
+
+// In-kernel datagram consumers
+// Other kernel modules can register to be handed received datagrams directly, without going through userspace.
+//
+// By default the receive callback is called from the receive path itself, in hrtimer (hard interrupt) context,
+// as soon as the final character of a matching datagram has been sampled. In that context the callback:
+//  - must not sleep or take a mutex
+//  - must return within a few tens of microseconds; the next character's start bit may arrive one bit time
+//    (208us) later and is not sampled until the callback returns
+//  - may only use the record during the call. It points at the receiver's own buffer and is not copied
+// A consumer with SEATALK_CONSUMER_DEFERRED set is instead called from a work item in process context with a
+// copy of the record. It may sleep but sees datagrams later and may miss some if it falls too far behind.
+// Deferred callbacks are made with the consumer list locked, so they must not call seatalk_register_consumer()
+// or seatalk_unregister_consumer() (for any consumer) or wait for anything that does; that deadlocks. Schedule
+// a work item of your own to do it instead.
+
+#include <linux/list.h>
+#include "seatalk_hardware_gpio_uapi.h"
+
+#define SEATALK_CONSUMER_DEFERRED 0x1
+
+struct seatalk_consumer {
+  // port to receive from
+  int port;
+  // only datagrams whose command byte is selected here are passed to receive()
+  struct seatalk_command_filter filter;
+  unsigned int flags;
+  void (*receive)(const struct seatalk_datagram_record *record, void *context);
+  void *context;
+  // used by the hardware layer
+  struct list_head list;
+};
+
+// the consumer must stay allocated and unchanged until it has been unregistered
+int seatalk_register_consumer(struct seatalk_consumer *consumer);
+// once this returns receive() will not be called again and is not running. May sleep; never call it from
+// receive()
+void seatalk_unregister_consumer(struct seatalk_consumer *consumer);
+
+#endif
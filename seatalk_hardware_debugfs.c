@@ -0,0 +1,52 @@
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// debugfs
+// Counters and diagnostics live under /sys/kernel/debug/seatalk/port0/. None of it is a stable interface.
+
+struct seatalk_statistics seatalk_statistics;
+
+static struct dentry *seatalk_debugfs_root = NULL;
+
+DEFINE_SHOW_ATTRIBUTE(seatalk_tx_class_latency);
+DEFINE_SHOW_ATTRIBUTE(seatalk_governor);
+DEFINE_SHOW_ATTRIBUTE(seatalk_meter);
+DEFINE_SHOW_ATTRIBUTE(seatalk_replay_status);
+
+int seatalk_debugfs_init(void) {
+  struct dentry *port;
+
+  seatalk_debugfs_root = debugfs_create_dir("seatalk", NULL);
+  port = debugfs_create_dir("port0", seatalk_debugfs_root);
+  debugfs_create_u64("tx_collisions", 0444, port, &seatalk_statistics.tx_collisions);
+  debugfs_create_u64("tx_retries", 0444, port, &seatalk_statistics.tx_retries);
+  debugfs_create_u64("tx_give_ups", 0444, port, &seatalk_statistics.tx_give_ups);
+  debugfs_create_u64("tx_start_deferrals", 0444, port, &seatalk_statistics.tx_start_deferrals);
+  debugfs_create_u64("rx_echo_suppressed", 0444, port, &seatalk_statistics.rx_echo_suppressed);
+  debugfs_create_u64("rx_echo_mismatches", 0444, port, &seatalk_statistics.rx_echo_mismatches);
+  debugfs_create_u64("tx_coalesced", 0444, port, &seatalk_statistics.tx_coalesced);
+  debugfs_create_file("tx_class_latency", 0444, port, NULL, &seatalk_tx_class_latency_fops);
+  debugfs_create_u64("tx_timed", 0444, port, &seatalk_statistics.tx_timed);
+  debugfs_create_u64("tx_schedule_error_total_ns", 0444, port, &seatalk_statistics.tx_schedule_error_total_ns);
+  debugfs_create_u64("tx_schedule_error_max_ns", 0444, port, &seatalk_statistics.tx_schedule_error_max_ns);
+  debugfs_create_u64("tx_throttled_ns", 0444, port, &seatalk_statistics.tx_throttled_ns);
+  debugfs_create_u64("tx_transport_throttled_ns", 0444, port, &seatalk_statistics.tx_transport_throttled_ns);
+  debugfs_create_file("tx_governor", 0444, port, NULL, &seatalk_governor_fops);
+  debugfs_create_file("bus_utilization", 0444, port, NULL, &seatalk_meter_fops);
+  debugfs_create_u64("rx_framing_errors", 0444, port, &seatalk_statistics.rx_framing_errors);
+  debugfs_create_u64("rx_decoder_mismatches", 0444, port, &seatalk_statistics.rx_decoder_mismatches);
+  debugfs_create_u64("rx_irq_storms", 0444, port, &seatalk_statistics.rx_irq_storms);
+  debugfs_create_u64("flight_triggers", 0444, port, &seatalk_statistics.flight_triggers);
+  debugfs_create_file("flight_recorder", 0600, port, NULL, &seatalk_flight_fops);
+  debugfs_create_u64("rx_datagrams", 0444, port, &seatalk_statistics.rx_datagrams);
+  debugfs_create_file("replay", 0200, port, NULL, &seatalk_replay_fops);
+  debugfs_create_file("replay_status", 0444, port, NULL, &seatalk_replay_status_fops);
+  return 0;
+}
+
+void seatalk_debugfs_exit(void) {
+  debugfs_remove_recursive(seatalk_debugfs_root);
+  seatalk_debugfs_root = NULL;
+}
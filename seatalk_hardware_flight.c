@@ -0,0 +1,119 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/atomic.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// Flight recorder
+// Always on. The last FLIGHT_EVENTS RxD edges, RxD bit samples and TxD level changes are kept in a ring. When
+// something goes wrong (a framing error, a collision or an interrupt storm) the ring is frozen into a snapshot
+// that stays in debugfs (flight_recorder) until it is cleared by writing to the file, so each failure comes
+// with the waveform that led up to it. Later failures are only counted until the snapshot is cleared.
+//
+// Recording takes no locks: each writer claims a slot with an atomic increment. A snapshot taken while another
+// CPU is writing may therefore contain one half-written event.
+
+#define FLIGHT_EVENTS 512
+
+struct flight_event {
+  // CLOCK_MONOTONIC
+  u64 timestamp_ns;
+  u8 type;
+  u8 value;
+};
+
+static const char *const event_names[] = {
+  [SEATALK_FLIGHT_RX_EDGE] = "rx_edge",
+  [SEATALK_FLIGHT_RX_SAMPLE] = "rx_sample",
+  [SEATALK_FLIGHT_TX_LEVEL] = "tx_level",
+  [SEATALK_FLIGHT_FRAMING_ERROR] = "framing_error",
+  [SEATALK_FLIGHT_COLLISION] = "collision",
+  [SEATALK_FLIGHT_IRQ_STORM] = "irq_storm",
+};
+
+static struct flight_event flight_ring[FLIGHT_EVENTS];
+// number of events ever recorded
+static atomic_t flight_head = ATOMIC_INIT(0);
+
+enum snapshot_state { SNAPSHOT_EMPTY, SNAPSHOT_FILLING, SNAPSHOT_READY };
+
+static struct {
+  int reason;
+  u64 frozen_ns;
+  // flight_head when frozen; the oldest event is events[head % FLIGHT_EVENTS]
+  unsigned int head;
+  struct flight_event events[FLIGHT_EVENTS];
+} snapshot;
+static atomic_t snapshot_state = ATOMIC_INIT(SNAPSHOT_EMPTY);
+
+void seatalk_flight_record(u64 timestamp_ns, int type, int value) {
+  struct flight_event *event = &flight_ring[(unsigned int)(atomic_inc_return(&flight_head) - 1) % FLIGHT_EVENTS];
+
+  event->timestamp_ns = timestamp_ns;
+  event->type = type;
+  event->value = value;
+}
+
+void seatalk_flight_freeze(int reason) {
+  u64 now = ktime_get_ns();
+
+  seatalk_flight_record(now, reason, 0);
+  seatalk_statistics.flight_triggers++;
+  // keep the first failure until somebody has looked at it
+  if (atomic_cmpxchg(&snapshot_state, SNAPSHOT_EMPTY, SNAPSHOT_FILLING) != SNAPSHOT_EMPTY) {
+    return;
+  }
+  snapshot.reason = reason;
+  snapshot.frozen_ns = now;
+  snapshot.head = atomic_read(&flight_head);
+  memcpy(snapshot.events, flight_ring, sizeof(flight_ring));
+  smp_wmb();
+  atomic_set(&snapshot_state, SNAPSHOT_READY);
+}
+
+static int flight_show(struct seq_file *file, void *unused) {
+  const struct flight_event *event;
+  u64 previous = 0;
+  int i;
+
+  if (atomic_read(&snapshot_state) != SNAPSHOT_READY) {
+    seq_puts(file, "empty\n");
+    return 0;
+  }
+  smp_rmb();
+  seq_printf(file, "reason %s at %llu\n", event_names[snapshot.reason], snapshot.frozen_ns);
+  seq_puts(file, "timestamp_ns delta_ns event value\n");
+  for (i = 0; i < FLIGHT_EVENTS; i++) {
+    event = &snapshot.events[(snapshot.head + i) % FLIGHT_EVENTS];
+    // not yet used since the driver was loaded
+    if (!event->timestamp_ns || event->type >= ARRAY_SIZE(event_names)) {
+      continue;
+    }
+    seq_printf(file, "%llu %lld %s %d\n", event->timestamp_ns, previous ? (s64)(event->timestamp_ns - previous) : 0LL, event_names[event->type], event->value);
+    previous = event->timestamp_ns;
+  }
+  return 0;
+}
+
+static int flight_open(struct inode *inode, struct file *file) {
+  return single_open(file, flight_show, NULL);
+}
+
+// any write clears the snapshot so the next failure can be caught
+static ssize_t flight_write(struct file *file, const char __user *buffer, size_t count, loff_t *offset) {
+  if (atomic_read(&snapshot_state) == SNAPSHOT_READY) {
+    atomic_set(&snapshot_state, SNAPSHOT_EMPTY);
+  }
+  return count;
+}
+
+const struct file_operations seatalk_flight_fops = {
+  .owner = THIS_MODULE,
+  .open = flight_open,
+  .read = seq_read,
+  .write = flight_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
@@ -0,0 +1,153 @@
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// Bus load governor
+// Other instruments share the bus and their data starts to collide and drop once it is more than about 60-70% busy.
+// tx_load_limit caps the share of bus time the local transmitter may use with a token bucket measured in bus time:
+// tokens accumulate at tx_load_limit percent of real time, up to tx_load_burst bit times, and starting a datagram
+// spends its length in bit times. A datagram that cannot be afforded stays queued until it can.
+// tx_class_load_limits applies a further bucket of the same kind to each transmit class; the queue passes over a
+// class that is out of budget so the classes behind it still go.
+// The transport layer's datagrams only come to light bit by bit as it sends them, so they are paid for from the
+// port-wide bucket once sent, which may leave it in debt. A transport layer request is held back until the bucket
+// could pay for the shortest datagram; alarms and commands may still go meanwhile if their own budgets allow.
+// Datagrams being resent after a collision are not governed; the backoff already spaces them out.
+//
+// Every function here must be called with the transmitter's tx_lock held.
+
+// the governor's utilization figure is averaged over this period
+#define UTILIZATION_WINDOW_NS NSEC_PER_SEC
+// command, attribute and one data byte
+#define SHORTEST_DATAGRAM_CHARACTERS 3
+
+static int tx_load_limit = 0;
+module_param(tx_load_limit, int, 0644);
+MODULE_PARM_DESC(tx_load_limit, "Percentage of bus time local transmissions may use (0 for no limit)");
+
+static int tx_load_burst = 2 * SEATALK_MAX_DATAGRAM_LENGTH * CHARACTER_BITS;
+module_param(tx_load_burst, int, 0644);
+MODULE_PARM_DESC(tx_load_burst, "Bit times of transmission that may be saved up while the bus is quiet");
+
+static int tx_class_load_limits[SEATALK_TX_CLASSES];
+module_param_array(tx_class_load_limits, int, NULL, 0644);
+MODULE_PARM_DESC(tx_class_load_limits, "Percentage of bus time each transmit class may use (0 for no limit of its own)");
+
+struct token_bucket {
+  // unspent bus time in nanoseconds
+  s64 tokens_ns;
+  // time tokens_ns was last brought up to date; zero until first used
+  u64 updated_ns;
+};
+
+static struct token_bucket port_bucket;
+static struct token_bucket class_buckets[SEATALK_TX_CLASSES];
+
+// local transmit time in the current and previous utilization windows
+static u64 window_start_ns;
+static u64 window_tx_ns;
+static u64 previous_window_tx_ns;
+
+static s64 datagram_cost(const struct seatalk_tx_datagram *datagram) {
+  return (s64)datagram->length * CHARACTER_BITS * BIT_INTERVAL;
+}
+
+// bring a bucket up to date and return how long to wait before it can pay cost_ns
+static s64 bucket_delay(struct token_bucket *bucket, int limit, s64 cost_ns, u64 now) {
+  // a bucket must be able to hold a whole datagram or that datagram would never go
+  s64 capacity = max((s64)READ_ONCE(tx_load_burst) * BIT_INTERVAL, cost_ns);
+
+  if (limit <= 0) {
+    return 0;
+  }
+  limit = min(limit, 100);
+  if (!bucket->updated_ns) {
+    bucket->tokens_ns = capacity;
+  } else {
+    bucket->tokens_ns = min(capacity, bucket->tokens_ns + (s64)div_u64((now - bucket->updated_ns) * limit, 100));
+  }
+  bucket->updated_ns = now;
+  if (bucket->tokens_ns >= cost_ns) {
+    return 0;
+  }
+  return div_s64((cost_ns - bucket->tokens_ns) * 100, limit);
+}
+
+static void bucket_charge(struct token_bucket *bucket, int limit, s64 cost_ns) {
+  if (limit > 0) {
+    bucket->tokens_ns -= cost_ns;
+  }
+}
+
+static void roll_window(u64 now) {
+  if (now - window_start_ns < UTILIZATION_WINDOW_NS) {
+    return;
+  }
+  // a window with nothing sent in it leaves no trace, so the previous one only counts if it has just ended
+  previous_window_tx_ns = now - window_start_ns < 2 * UTILIZATION_WINDOW_NS ? window_tx_ns : 0;
+  window_start_ns = now;
+  window_tx_ns = 0;
+}
+
+s64 seatalk_governor_class_delay(const struct seatalk_tx_datagram *datagram) {
+  return bucket_delay(&class_buckets[datagram->class], READ_ONCE(tx_class_load_limits[datagram->class]), datagram_cost(datagram), ktime_get_ns());
+}
+
+s64 seatalk_governor_port_delay(const struct seatalk_tx_datagram *datagram) {
+  return bucket_delay(&port_bucket, READ_ONCE(tx_load_limit), datagram_cost(datagram), ktime_get_ns());
+}
+
+s64 seatalk_governor_delay(const struct seatalk_tx_datagram *datagram) {
+  return max(seatalk_governor_port_delay(datagram), seatalk_governor_class_delay(datagram));
+}
+
+void seatalk_governor_charge(const struct seatalk_tx_datagram *datagram) {
+  s64 cost = datagram_cost(datagram);
+
+  bucket_charge(&port_bucket, READ_ONCE(tx_load_limit), cost);
+  bucket_charge(&class_buckets[datagram->class], READ_ONCE(tx_class_load_limits[datagram->class]), cost);
+  roll_window(ktime_get_ns());
+  window_tx_ns += cost;
+}
+
+s64 seatalk_governor_transport_delay(void) {
+  return bucket_delay(&port_bucket, READ_ONCE(tx_load_limit), (s64)SHORTEST_DATAGRAM_CHARACTERS * CHARACTER_BITS * BIT_INTERVAL, ktime_get_ns());
+}
+
+void seatalk_governor_charge_transport(int characters) {
+  u64 now = ktime_get_ns();
+  s64 cost = (s64)characters * CHARACTER_BITS * BIT_INTERVAL;
+  int limit = READ_ONCE(tx_load_limit);
+
+  // bring the bucket up to date before spending from it
+  bucket_delay(&port_bucket, limit, 0, now);
+  bucket_charge(&port_bucket, limit, cost);
+  roll_window(now);
+  window_tx_ns += cost;
+}
+
+// debugfs tx_governor: settings, bus utilization by our transmissions (the transport layer's included) and the
+// state of each bucket
+int seatalk_governor_show(struct seq_file *file, void *unused) {
+  u64 now = ktime_get_ns();
+  u64 utilization = 0;
+  int class;
+
+  // read without tx_lock so the figures may be a datagram out of date
+  if (now - window_start_ns < UTILIZATION_WINDOW_NS) {
+    utilization = previous_window_tx_ns;
+  } else if (now - window_start_ns < 2 * UTILIZATION_WINDOW_NS) {
+    utilization = window_tx_ns;
+  }
+  seq_printf(file, "load_limit_percent %d\n", tx_load_limit);
+  seq_printf(file, "burst_bits %d\n", tx_load_burst);
+  seq_printf(file, "utilization_percent %llu\n", div64_u64(utilization * 100, UTILIZATION_WINDOW_NS));
+  seq_printf(file, "throttled_us %llu\n", div_u64(seatalk_statistics.tx_throttled_ns, NSEC_PER_USEC));
+  seq_printf(file, "transport_throttled_us %llu\n", div_u64(seatalk_statistics.tx_transport_throttled_ns, NSEC_PER_USEC));
+  seq_printf(file, "port_tokens_bits %lld\n", div_s64(port_bucket.tokens_ns, BIT_INTERVAL));
+  for (class = 0; class < SEATALK_TX_CLASSES; class++) {
+    seq_printf(file, "class%d_limit_percent %d tokens_bits %lld\n", class, tx_class_load_limits[class], div_s64(class_buckets[class].tokens_ns, BIT_INTERVAL));
+  }
+  return 0;
+}
@@ -0,0 +1,223 @@
+#ifndef SEATALK_HARDWARE_GPIO_H
+#define SEATALK_HARDWARE_GPIO_H
+
+// Declarations shared between the source files of the GPIO hardware layer.
+// Nothing in here is part of the contract with the seatalk library (see ../seatalk/seatalk_hardware_layer.h).
+
+#include <linux/list.h>
+#include "seatalk_hardware_gpio_uapi.h"
+#include "seatalk_hardware_submit.h"
+
+struct vm_area_struct;
+struct seq_file;
+struct file_operations;
+
+// bit timer period (see the uapi header)
+#define BIT_INTERVAL SEATALK_BIT_INTERVAL_NS
+#define CHARACTER_BITS SEATALK_CHARACTER_BITS
+
+// simulated line (seatalk_hardware_layer.c)
+int seatalk_line_simulated(void);
+// drive the simulated line as if another talker had. Returns -ENODEV unless simulate_line is set
+int seatalk_inject_rx_level(int level);
+// divide the receiver's bit timing by speed (1 for the real bus)
+void seatalk_set_rx_speed(int speed);
+
+// transmitter (seatalk_hardware_layer.c)
+// queue a datagram to be sent by the hardware layer rather than seatalk_transport_layer.c
+// tx_class is an enum seatalk_tx_class. Safe to call from any context. Returns 0, -EINVAL if the port does not
+// exist, the length does not match the attribute byte or the class is unknown, or -ENOSPC if the queue for that
+// class is full
+int seatalk_hardware_queue_datagram(int seatalk_port, int tx_class, const unsigned char *bytes, int length);
+
+// a datagram waiting for, or being sent by, the local transmitter
+struct seatalk_tx_datagram {
+  struct list_head list;
+  int length;
+  unsigned char bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  // enum seatalk_tx_class
+  int class;
+  // CLOCK_MONOTONIC time it was queued
+  u64 enqueued_ns;
+  // set once its first bit has been sent
+  int started;
+  // CLOCK_MONOTONIC time the first bit of the latest attempt was sent
+  u64 start_ns;
+  // CLOCK_MONOTONIC time the first bit should be sent, or zero to send it as soon as possible
+  u64 target_ns;
+  // who to tell when it has gone; complete is NULL if nobody wants to know
+  u64 cookie;
+  seatalk_tx_complete_t complete;
+  void *context;
+  // number of times this datagram has been cut short by a collision
+  int collisions;
+  // a copy of a transport layer datagram being retransmitted by the hardware layer
+  int from_transport;
+};
+
+// local transmit queue (seatalk_hardware_tx_queue.c). All must be called with the transmitter's lock held
+// returns 0 if queued, -ENOSPC if the datagram's class (or the timed queue) is full or 1 if its contents replaced
+// a waiting datagram (in which case the caller still owns it)
+int seatalk_tx_queue_push(struct seatalk_tx_datagram *datagram);
+// next datagram of class lowest_class or above to send according to the class scheduling rules and the load
+// limits, or NULL if none may start now. Timed datagrams are only ready shortly before their target time.
+// Pass SEATALK_TX_CLASSES - 1 to consider every class
+struct seatalk_tx_datagram *seatalk_tx_queue_pop(int lowest_class);
+// CLOCK_MONOTONIC time at which a datagram that pop passed over may be ready, or zero if nothing is queued
+u64 seatalk_tx_queue_next_ready(void);
+// the first bit of a queued datagram is on the wire; record its queueing latency
+void seatalk_tx_queue_started(struct seatalk_tx_datagram *datagram);
+// report what became of a datagram to whoever queued it. status is as in struct seatalk_tx_completion
+void seatalk_tx_complete(struct seatalk_tx_datagram *datagram, int status);
+// complete everything still queued with -ECANCELED and free it
+void seatalk_tx_queue_discard(void);
+// debugfs tx_class_latency contents
+int seatalk_tx_class_latency_show(struct seq_file *file, void *unused);
+
+// bus load governor (seatalk_hardware_governor.c). Called with the transmitter's lock held
+// nanoseconds to wait before the datagram may start without going over the load limits; 0 if it may start now
+s64 seatalk_governor_delay(const struct seatalk_tx_datagram *datagram);
+// the same for its class's own limit and for the port-wide limit alone
+s64 seatalk_governor_class_delay(const struct seatalk_tx_datagram *datagram);
+s64 seatalk_governor_port_delay(const struct seatalk_tx_datagram *datagram);
+// the datagram is starting; spend its bus time
+void seatalk_governor_charge(const struct seatalk_tx_datagram *datagram);
+// nanoseconds to wait before a transport layer datagram may start under the port-wide limit; 0 if it may start now
+s64 seatalk_governor_transport_delay(void);
+// the transport layer has just sent this many characters; spend their bus time
+void seatalk_governor_charge_transport(int characters);
+// debugfs tx_governor contents
+int seatalk_governor_show(struct seq_file *file, void *unused);
+
+// bus utilization meter (seatalk_hardware_meter.c). Safe to call from interrupt context
+// a start bit was seen at CLOCK_MONOTONIC time start_ns
+void seatalk_meter_character(u64 start_ns);
+// a complete datagram was received (or our own was echoed back)
+void seatalk_meter_datagram(u8 command);
+// debugfs bus_utilization contents
+int seatalk_meter_show(struct seq_file *file, void *unused);
+
+// edge capture (seatalk_hardware_capture.c)
+// the edge_capture and edge_capture_tx module parameters
+extern bool seatalk_edge_capture;
+extern bool seatalk_edge_capture_tx;
+// does nothing unless edge_capture is set
+int seatalk_capture_init(void);
+void seatalk_capture_exit(void);
+// record a line level change. tx is set for a level we drove. Safe from any context
+void seatalk_capture_edge(u64 timestamp_ns, int level, int tx);
+// map the ring read-only into a userspace process
+int seatalk_capture_mmap(struct vm_area_struct *vma);
+
+// flight recorder (seatalk_hardware_flight.c). Both safe from any context and take no locks
+enum seatalk_flight_event_type {
+  // value is the level the line went to
+  SEATALK_FLIGHT_RX_EDGE,
+  // value is the bit sampled
+  SEATALK_FLIGHT_RX_SAMPLE,
+  // value is the level driven
+  SEATALK_FLIGHT_TX_LEVEL,
+  // freeze reasons
+  SEATALK_FLIGHT_FRAMING_ERROR,
+  SEATALK_FLIGHT_COLLISION,
+  SEATALK_FLIGHT_IRQ_STORM,
+};
+void seatalk_flight_record(u64 timestamp_ns, int type, int value);
+// something went wrong. Keep a snapshot of the recent events unless one is already waiting to be read
+void seatalk_flight_freeze(int reason);
+// debugfs flight_recorder
+extern const struct file_operations seatalk_flight_fops;
+
+// replay injector (seatalk_hardware_replay.c). Does nothing unless simulate_line is set
+int seatalk_replay_init(void);
+void seatalk_replay_exit(void);
+// debugfs replay (write an edge capture to play it) and replay_status
+extern const struct file_operations seatalk_replay_fops;
+int seatalk_replay_status_show(struct seq_file *file, void *unused);
+
+// character device (seatalk_hardware_chardev.c)
+int seatalk_chardev_init(void);
+void seatalk_chardev_exit(void);
+// hand a completed datagram to every open reader whose filter selects its command byte
+// called from timer context so must not sleep
+void seatalk_chardev_deliver(const struct seatalk_datagram_record *record);
+
+// latest-value table (seatalk_hardware_latest.c)
+int seatalk_latest_init(void);
+void seatalk_latest_exit(void);
+// record a completed datagram in the table. Only ever called from the receive timer so there is a single writer
+void seatalk_latest_update(const struct seatalk_datagram_record *record);
+// map the table read-only into a userspace process
+int seatalk_latest_mmap(struct vm_area_struct *vma);
+
+// network device (seatalk_hardware_netdev.c)
+// does nothing unless the network_device module parameter is set
+int seatalk_netdev_init(void);
+void seatalk_netdev_exit(void);
+// pass a received datagram up the network stack. Called from timer context
+void seatalk_netdev_deliver(const struct seatalk_datagram_record *record);
+// a datagram of this transmit class has left the queue; restart the interface's queue for the class if it was full.
+// Called with the transmitter's lock held
+void seatalk_netdev_wake(int tx_class);
+
+// generic netlink family (seatalk_hardware_netlink.c)
+int seatalk_netlink_init(void);
+void seatalk_netlink_exit(void);
+// multicast a received datagram to subscribed sockets. Called from timer context; the message is built later in a work item
+void seatalk_netlink_deliver(const struct seatalk_datagram_record *record);
+
+// in-kernel consumers (seatalk_hardware_consumer.c, API in seatalk_hardware_consumer.h)
+int seatalk_consumer_init(void);
+void seatalk_consumer_exit(void);
+// call immediate consumers and queue the datagram for deferred ones. Called from timer context
+void seatalk_consumer_deliver(const struct seatalk_datagram_record *record);
+
+// enqueue-to-wire latency of local datagrams in one transmit class
+struct seatalk_tx_class_statistics {
+  u64 sent;
+  u64 latency_total_ns;
+  u64 latency_max_ns;
+};
+
+// Counters for the single port, exported read-only through debugfs (seatalk_hardware_debugfs.c)
+struct seatalk_statistics {
+  // transmitted bits that did not read back the way they were driven
+  u64 tx_collisions;
+  // datagrams resent by the hardware layer after a collision
+  u64 tx_retries;
+  // datagrams abandoned after tx_collision_retries resends
+  u64 tx_give_ups;
+  // datagram starts pushed back because a character arrived during the guard time
+  u64 tx_start_deferrals;
+  // echoes of our own characters checked and kept away from the transport layer
+  u64 rx_echo_suppressed;
+  // echoed characters that differed from what was driven while tx_collision_detect was off
+  u64 rx_echo_mismatches;
+  // queued datagrams replaced by a newer one with the same command byte (tx_coalesce)
+  u64 tx_coalesced;
+  // total time local datagrams were held back by the bus load governor
+  u64 tx_throttled_ns;
+  // total time transport layer requests were held back by the bus load governor
+  u64 tx_transport_throttled_ns;
+  // stop bits sampled low and datagrams cut short by the next command byte
+  u64 rx_framing_errors;
+  // characters the transport layer sampled for more or fewer bits than the hardware layer's own decoder expects
+  u64 rx_decoder_mismatches;
+  // bursts of more than IRQ_STORM_EDGES RxD interrupts within IRQ_STORM_WINDOW_NS
+  u64 rx_irq_storms;
+  // datagrams delivered, including the echo of our own
+  u64 rx_datagrams;
+  // failures that would have frozen the flight recorder (only the first is kept until it is cleared)
+  u64 flight_triggers;
+  // timed datagrams started, and how far after their target times their first bits were sent
+  u64 tx_timed;
+  u64 tx_schedule_error_total_ns;
+  u64 tx_schedule_error_max_ns;
+  struct seatalk_tx_class_statistics tx_classes[SEATALK_TX_CLASSES];
+};
+extern struct seatalk_statistics seatalk_statistics;
+
+int seatalk_debugfs_init(void);
+void seatalk_debugfs_exit(void);
+
+#endif
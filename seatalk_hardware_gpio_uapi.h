@@ -0,0 +1,281 @@
+#ifndef SEATALK_HARDWARE_GPIO_UAPI_H
+#define SEATALK_HARDWARE_GPIO_UAPI_H
+
+// Definitions shared between the kernel driver and userspace programs that talk to it
+// through the /dev/seatalk character device.
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Line timing, shared with offline decoders (tools/seatalk_decode.h)
+// bit period; 1000000000 ns/s / 4800 bits/s
+#define SEATALK_BIT_INTERVAL_NS 208333
+// start bit, 8 data bits, command bit, stop bit
+#define SEATALK_CHARACTER_BITS 11
+// the receiver samples each bit this long into its bit cell, once the level has settled
+#define SEATALK_SAMPLE_DELAY_NS (SEATALK_BIT_INTERVAL_NS / 4)
+// edges are ignored for this long after the stop bit is sampled while it bounces
+#define SEATALK_DEBOUNCE_NS 60000
+
+// longest possible SeaTalk datagram: command byte, attribute byte and up to 16 data bytes
+// (the low nibble of the attribute byte gives the number of data bytes beyond the first)
+#define SEATALK_MAX_DATAGRAM_LENGTH 18
+
+// one received datagram as returned by read() on /dev/seatalk
+struct seatalk_datagram_record {
+  // CLOCK_MONOTONIC time at which the stop bit of the final character ended
+  __u64 timestamp_ns;
+  // CLOCK_MONOTONIC time of the start bit edge of the command byte; when the first reading in the datagram was sent
+  __u64 start_ns;
+  // the same instant as start_ns on CLOCK_TAI. Zero unless the driver was loaded with rx_tai_timestamps=1
+  __u64 start_tai_ns;
+  __u8 port;
+  // number of valid bytes in bytes[]
+  __u8 length;
+  // bytes[0] is the command byte
+  __u8 bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  __u8 reserved[4];
+};
+
+// set of command bytes a reader wants to receive
+// command byte n is selected when bit (n % 64) of bits[n / 64] is set
+struct seatalk_command_filter {
+  __u64 bits[4];
+};
+
+static inline void seatalk_command_filter_set(struct seatalk_command_filter *filter, __u8 command) {
+  filter->bits[command >> 6] |= (__u64)1 << (command & 63);
+}
+
+static inline int seatalk_command_filter_test(const struct seatalk_command_filter *filter, __u8 command) {
+  return (filter->bits[command >> 6] >> (command & 63)) & 1;
+}
+
+// Latest-value table
+// mmap() /dev/seatalk read-only at offset SEATALK_MMAP_LATEST_OFFSET to see the most recent datagram received
+// for every command byte without making any system calls. Index the table by command byte.
+// Each entry is protected by a sequence count (odd while the driver is updating it) so use
+// seatalk_latest_read() rather than reading the fields directly.
+#define SEATALK_LATEST_ENTRIES 256
+#define SEATALK_MMAP_LATEST_OFFSET 0
+
+struct seatalk_latest_entry {
+  __u32 sequence;
+  // number of times this command byte has been received since the driver was loaded
+  __u32 update_count;
+  // as in struct seatalk_datagram_record
+  __u64 timestamp_ns;
+  __u64 start_ns;
+  __u64 start_tai_ns;
+  // zero if this command byte has never been received
+  __u8 length;
+  __u8 bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  // pad to one 64-byte cache line per entry
+  __u8 reserved[13];
+};
+
+#define SEATALK_LATEST_TABLE_SIZE (SEATALK_LATEST_ENTRIES * sizeof(struct seatalk_latest_entry))
+
+#ifndef __KERNEL__
+// take a consistent copy of one table entry, retrying if the driver updated it while we were copying
+static inline void seatalk_latest_read(const struct seatalk_latest_entry *entry, struct seatalk_latest_entry *copy) {
+  __u32 sequence;
+
+  do {
+    while ((sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE)) & 1) {
+      // update in progress
+    }
+    __builtin_memcpy(copy, entry, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) != sequence);
+  copy->sequence = sequence;
+}
+#endif
+
+// Edge capture
+// Load with edge_capture=1 to record the time and new level of every RxD edge (and with edge_capture_tx=1 every
+// level change we drive on TxD) in a ring that can be mapped read-only at SEATALK_MMAP_EDGES_OFFSET.
+// Each edge is a CLOCK_MONOTONIC nanosecond timestamp shifted left by SEATALK_EDGE_FLAG_BITS with the new logic
+// level in SEATALK_EDGE_LEVEL and SEATALK_EDGE_TX set for a level we drove. The driver overwrites the oldest
+// edges when the ring is full and never waits for readers; use seatalk_edges_read() to copy edges out.
+#define SEATALK_MMAP_EDGES_OFFSET 0x200000
+#define SEATALK_EDGE_ENTRIES 32768
+#define SEATALK_EDGE_LEVEL 1
+#define SEATALK_EDGE_TX 2
+#define SEATALK_EDGE_FLAG_BITS 2
+
+struct seatalk_edge_ring {
+  // number of edges ever written. Edge n is in edges[n % SEATALK_EDGE_ENTRIES]
+  __u64 head;
+  __u64 reserved[7];
+  __u64 edges[SEATALK_EDGE_ENTRIES];
+};
+
+#define SEATALK_EDGE_RING_SIZE sizeof(struct seatalk_edge_ring)
+
+static inline __u64 seatalk_edge_time(__u64 edge) {
+  return edge >> SEATALK_EDGE_FLAG_BITS;
+}
+
+#ifndef __KERNEL__
+// copy up to count edges starting with edge number *position into edges[] and advance *position past them.
+// Returns the number copied. *lost is set to the number of edges from *position on that had already been
+// overwritten (they are skipped)
+static inline unsigned int seatalk_edges_read(const struct seatalk_edge_ring *ring, __u64 *position, __u64 *edges, unsigned int count, __u64 *lost) {
+  __u64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  __u64 start = *position;
+  __u64 overwritten;
+  unsigned int i;
+
+  *lost = 0;
+  if (head - start > SEATALK_EDGE_ENTRIES) {
+    *lost = head - SEATALK_EDGE_ENTRIES - start;
+    start = head - SEATALK_EDGE_ENTRIES;
+  }
+  if (head - start < count) {
+    count = head - start;
+  }
+  for (i = 0; i < count; i++) {
+    edges[i] = ring->edges[(start + i) % SEATALK_EDGE_ENTRIES];
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  // the driver may have lapped us while we copied. Edge head is possibly being written over edge head - ENTRIES
+  head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  if (head + 1 > start + SEATALK_EDGE_ENTRIES) {
+    overwritten = head + 1 - SEATALK_EDGE_ENTRIES - start;
+    if (overwritten > count) {
+      overwritten = count;
+    }
+    for (i = 0; i + overwritten < count; i++) {
+      edges[i] = edges[i + overwritten];
+    }
+    *lost += overwritten;
+    start += overwritten;
+    count -= overwritten;
+  }
+  *position = start + count;
+  return count;
+}
+#endif
+
+// Transmit classes
+// The hardware layer keeps a separate transmit queue for each class. Alarms always go first; by default the
+// other classes are served in strict priority order too (see the tx_class_weights module parameter).
+enum seatalk_tx_class {
+  // man overboard and other alarms
+  SEATALK_TX_CLASS_ALARM,
+  // autopilot and other commands
+  SEATALK_TX_CLASS_COMMAND,
+  // instrument data; the default
+  SEATALK_TX_CLASS_DATA,
+  // display repeats and anything else that can wait
+  SEATALK_TX_CLASS_ROUTINE,
+  SEATALK_TX_CLASSES,
+};
+
+// Batched transmission
+// SEATALK_IOC_SUBMIT queues up to SEATALK_TX_BATCH_MAX datagrams in one call and returns at once. Like sending
+// through generic netlink it needs CAP_NET_ADMIN; without it the call fails with EPERM. The outcome of
+// every request, including any that could not be queued, is reported through the open file's completion ring:
+// mmap() SEATALK_COMPLETION_RING_SIZE bytes of /dev/seatalk read-write at SEATALK_MMAP_COMPLETION_OFFSET.
+// The driver fills entries[head % SEATALK_COMPLETION_ENTRIES] and then advances head; advance tail once you
+// have read an entry. poll() reports EPOLLPRI while there are unread completions.
+// A request with a target time is held until then and sent as close to it as the bus allows (after alarms, with the
+// usual guard time and collision handling). Up to SEATALK_TX_TIMED_MAX timed datagrams can be waiting at once;
+// compare start_ns in the completion with target_ns to see how close it came.
+#define SEATALK_TX_BATCH_MAX 64
+#define SEATALK_TX_TIMED_MAX 256
+#define SEATALK_COMPLETION_ENTRIES 256
+#define SEATALK_MMAP_COMPLETION_OFFSET 0x100000
+
+struct seatalk_tx_request {
+  // returned unchanged in the completion
+  __u64 cookie;
+  // CLOCK_MONOTONIC time for the first start bit, or zero to send as soon as possible
+  __u64 target_ns;
+  // ignored; there is only one port
+  __u8 port;
+  // enum seatalk_tx_class
+  __u8 tx_class;
+  __u8 length;
+  __u8 bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  __u8 reserved[3];
+};
+
+struct seatalk_tx_batch {
+  // user pointer to count struct seatalk_tx_request
+  __u64 requests;
+  __u32 count;
+  // set by the driver to the number of requests queued. The rest have already been completed with an error
+  __u32 queued;
+};
+
+struct seatalk_tx_completion {
+  __u64 cookie;
+  // CLOCK_MONOTONIC times the first start bit of the datagram's last attempt was driven and its final stop bit
+  // ended. Zero if it never reached the wire or (end_ns) was not sent successfully
+  __u64 start_ns;
+  __u64 end_ns;
+  // 0 once sent. -EINVAL, -ENOSPC or -ENOMEM if it could not be queued (-ENOSPC also if SEATALK_TX_TIMED_MAX timed
+  // datagrams are already waiting); -ECOMM if abandoned after collisions;
+  // -ECANCELED if replaced by a newer datagram (tx_coalesce) or discarded when the driver was unloaded
+  __s32 status;
+  __u32 reserved;
+};
+
+struct seatalk_completion_ring {
+  // written only by the driver
+  __u32 head;
+  // written only by the reader
+  __u32 tail;
+  // completions lost because the ring was full
+  __u32 overruns;
+  __u32 reserved[13];
+  struct seatalk_tx_completion entries[SEATALK_COMPLETION_ENTRIES];
+};
+
+#define SEATALK_COMPLETION_RING_SIZE sizeof(struct seatalk_completion_ring)
+
+// Generic netlink
+// Every received datagram is multicast once to the SEATALK_GENL_MCGRP_RX group of the SEATALK_GENL_NAME family
+// as a SEATALK_CMD_DATAGRAM message. Send a SEATALK_CMD_TRANSMIT message with a SEATALK_ATTR_DATA attribute
+// (needs CAP_NET_ADMIN) to queue a datagram for transmission.
+#define SEATALK_GENL_NAME "seatalk"
+#define SEATALK_GENL_VERSION 1
+#define SEATALK_GENL_MCGRP_RX "rx"
+
+enum seatalk_genl_command {
+  SEATALK_CMD_UNSPEC,
+  SEATALK_CMD_DATAGRAM,
+  SEATALK_CMD_TRANSMIT,
+  __SEATALK_CMD_MAX,
+};
+#define SEATALK_CMD_MAX (__SEATALK_CMD_MAX - 1)
+
+enum seatalk_genl_attribute {
+  SEATALK_ATTR_UNSPEC,
+  // u8. Optional on SEATALK_CMD_TRANSMIT, where any port but 0 is rejected with EINVAL
+  SEATALK_ATTR_PORT,
+  // u64 CLOCK_MONOTONIC nanoseconds at the end of the datagram's last stop bit
+  SEATALK_ATTR_TIMESTAMP,
+  // binary, the datagram starting with its command byte
+  SEATALK_ATTR_DATA,
+  SEATALK_ATTR_PAD,
+  // u8 enum seatalk_tx_class, optional on SEATALK_CMD_TRANSMIT
+  SEATALK_ATTR_CLASS,
+  // u64 CLOCK_MONOTONIC nanoseconds at the datagram's first start bit edge
+  SEATALK_ATTR_START_TIMESTAMP,
+  // u64 CLOCK_TAI nanoseconds at the datagram's first start bit edge. Only present with rx_tai_timestamps=1
+  SEATALK_ATTR_START_TAI,
+  __SEATALK_ATTR_MAX,
+};
+#define SEATALK_ATTR_MAX (__SEATALK_ATTR_MAX - 1)
+
+#define SEATALK_IOC_MAGIC 'S'
+// replace the command byte filter for this open file. A newly opened file receives every datagram.
+#define SEATALK_IOC_SET_FILTER _IOW(SEATALK_IOC_MAGIC, 1, struct seatalk_command_filter)
+#define SEATALK_IOC_GET_FILTER _IOR(SEATALK_IOC_MAGIC, 2, struct seatalk_command_filter)
+// queue a batch of datagrams for transmission (see Batched transmission above)
+#define SEATALK_IOC_SUBMIT _IOWR(SEATALK_IOC_MAGIC, 3, struct seatalk_tx_batch)
+
+#endif
@@ -0,0 +1,55 @@
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include "seatalk_hardware_gpio.h"
+
+// Latest-value table
+// Holds the most recent datagram for each command byte. Displays and exporters that only want the current
+// value of each datagram type map this read-only and poll it; they never make a system call or take a lock
+// and the driver never has to wake them.
+//
+// The receive timer is the only writer. Each entry has its own sequence count which is odd while the entry
+// is being rewritten; readers retry if the count changed while they were copying (see seatalk_latest_read()).
+
+static struct seatalk_latest_entry *latest_table;
+
+void seatalk_latest_update(const struct seatalk_datagram_record *record) {
+  struct seatalk_latest_entry *entry = &latest_table[record->bytes[0]];
+
+  // mark entry as being updated
+  WRITE_ONCE(entry->sequence, entry->sequence + 1);
+  smp_wmb();
+  entry->update_count++;
+  entry->timestamp_ns = record->timestamp_ns;
+  entry->start_ns = record->start_ns;
+  entry->start_tai_ns = record->start_tai_ns;
+  entry->length = record->length;
+  memcpy(entry->bytes, record->bytes, record->length);
+  smp_wmb();
+  // update complete
+  WRITE_ONCE(entry->sequence, entry->sequence + 1);
+}
+
+int seatalk_latest_mmap(struct vm_area_struct *vma) {
+  // readers get a snapshot view only
+  if (vma->vm_flags & VM_WRITE) {
+    return -EPERM;
+  }
+  vm_flags_clear(vma, VM_MAYWRITE);
+  return remap_vmalloc_range(vma, latest_table, 0);
+}
+
+int seatalk_latest_init(void) {
+  // vmalloc_user gives zeroed pages that can be mapped into userspace
+  latest_table = vmalloc_user(PAGE_ALIGN(SEATALK_LATEST_TABLE_SIZE));
+  if (!latest_table) {
+    pr_info("Unable to allocate latest-value table");
+    return -1;
+  }
+  return 0;
+}
+
+void seatalk_latest_exit(void) {
+  vfree(latest_table);
+  latest_table = NULL;
+}
@@ -1,9 +1,16 @@
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/interrupt.h>
 #include <linux/hrtimer.h>
 #include <linux/gpio.h>
+#include <linux/moduleparam.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/random.h>
 #include "../seatalk/seatalk_hardware_layer.h"
 #include "../seatalk/seatalk_transport_layer.h"
+#include "seatalk_hardware_gpio.h"
 
 // The Seatalk bus has one single wire pulled to High (+12V) when no value is being asserted.
 // A level translater must be built to convert that +12V high signal to something compatible with
@@ -41,12 +48,26 @@
 #define SEATALK_PORT 0
 
 // transmit and receive
-// bit timer period; 1000000000 ns/s / 4800 bits/s = 208333 ns/bit
-#define BIT_INTERVAL 208333
+// BIT_INTERVAL and CHARACTER_BITS are in seatalk_hardware_gpio.h
 // start receive timer 1/4 bit after triggering edge of start bit
 // this gives some time for the signal level to settle
-#define START_BIT_DELAY (BIT_INTERVAL / 4)
-#define DEBOUNCE_NANOS 60000
+#define START_BIT_DELAY SEATALK_SAMPLE_DELAY_NS
+#define DEBOUNCE_NANOS SEATALK_DEBOUNCE_NS
+
+// Simulated line
+// With simulate_line set no GPIO pins or IRQs are used. The hardware layer keeps the line level in a variable,
+// everything transmitted is received back through rxd_irq_handler and receive_bit exactly as if it had gone out
+// on the wire, so the whole stack can be exercised with no hardware attached.
+static bool simulate_line = 0;
+module_param(simulate_line, bool, 0444);
+MODULE_PARM_DESC(simulate_line, "Loop transmitted data back to the receiver instead of using GPIO pins");
+// current logic level of the simulated line; idle high
+static int simulated_line_value = 1;
+
+// receive bit timing. Always the real bus timing except while seatalk_hardware_replay.c plays a capture back
+// faster than it was recorded
+static int rx_bit_interval = BIT_INTERVAL;
+static int rx_debounce_nanos = DEBOUNCE_NANOS;
 
 // receive data state
 
@@ -62,8 +83,91 @@ static enum hrtimer_restart receive_bit(struct hrtimer *timer);
 // are we currently debouncing a signal state transition?
 int debouncing = 0;
 
+// IRQ storm detection
+// A real SeaTalk signal has at most one edge per bit time (and rxd_irq_handler normally sees only start bits).
+// More than IRQ_STORM_EDGES interrupts within IRQ_STORM_WINDOW_NS means noise or a floating input; the
+// flight recorder is frozen so the waveform can be seen.
+#define IRQ_STORM_WINDOW_NS 1000000
+#define IRQ_STORM_EDGES 32
+static u64 irq_storm_window_start;
+static int irq_storm_edges;
+
+// received datagram tracking
+// seatalk_transport_layer.c does the real decoding. The hardware layer samples the same bit cells alongside it so it
+// knows where each datagram begins and ends and can hand completed datagrams to the interfaces in seatalk_hardware_gpio.h
+// A character is 8 data bits (least significant first) followed by the command bit
+// This relies on the transport layer sampling exactly CHARACTER_DATA_BITS + 1 bits (the data bits and the stop bit)
+// for every character; rx_decoder_mismatches counts characters where it didn't
+#define CHARACTER_DATA_BITS 9
+#define COMMAND_BIT 0x100
+// data bits sampled so far for the character being received
+static int rx_bit_count = 0;
+static int rx_character = 0;
+// bits sampled so far for the character being received, including the stop bit
+static int rx_sample_count = 0;
+// datagram being assembled. A length of zero means we are waiting for a command byte
+static struct seatalk_datagram_record rx_datagram;
+static int rx_datagram_expected_length = 0;
+// CLOCK_MONOTONIC time of the start bit edge of the character being received, taken on entry to rxd_irq_handler
+static u64 rx_character_start_ns;
+
+// Every datagram carries the time of its first start bit edge and of the end of its last stop bit on CLOCK_MONOTONIC.
+// With rx_tai_timestamps set the first is also given on CLOCK_TAI for fusing with data from other systems.
+static bool rx_tai_timestamps = 0;
+module_param(rx_tai_timestamps, bool, 0644);
+MODULE_PARM_DESC(rx_tai_timestamps, "Also timestamp received datagrams on CLOCK_TAI");
+
+// Echo suppression
+// RX and TX share the bus so every character we send comes straight back to the receiver. With suppress_tx_echo
+// set, a start bit that arrives just as we drive one of our own is treated as our echo: the receiver compares the
+// echoed bits with what was driven instead of handing them to seatalk_transport_layer.c. A mismatch is handled as
+// a collision if tx_collision_detect is set and only counted otherwise.
+// The character still goes to datagram tracking so the interfaces in seatalk_hardware_gpio.h see our own traffic.
+static bool suppress_tx_echo = 0;
+module_param(suppress_tx_echo, bool, 0644);
+MODULE_PARM_DESC(suppress_tx_echo, "Check the echo of transmitted characters instead of decoding it as received data");
+// set while the receiver is handling the echo of one of our characters
+static int rx_echo = 0;
+// set once the current echoed character has been counted in rx_echo_mismatches
+static int rx_echo_mismatched = 0;
+
 // transmit data state
 
+// Local transmitter
+// Datagrams queued through seatalk_hardware_queue_datagram() (by the network device and the other interfaces in
+// seatalk_hardware_gpio.h) are sent by the hardware layer itself rather than by seatalk_transport_layer.c.
+// Both share hrtimer_txd and take turns a whole datagram at a time; tx_owner records whose bits the timer is sending.
+// The queue, and the order its datagrams are sent in, are in seatalk_hardware_tx_queue.c
+enum tx_owner { TX_IDLE, TX_TRANSPORT, TX_LOCAL };
+// idle bus time required before the local transmitter starts a datagram
+#define LOCAL_TX_GUARD_BITS CHARACTER_BITS
+
+// tx_lock protects everything below. Taken from timer context so interrupts must be disabled while it is held
+static DEFINE_SPINLOCK(tx_lock);
+static enum tx_owner tx_owner = TX_IDLE;
+// guard time (in bits) of a transport layer request that arrived while the local transmitter had the bus, or that
+// the load governor is holding back. Negative if there is none
+static int tx_transport_pending_delay = -1;
+// CLOCK_MONOTONIC time the load governor started holding back the pending transport layer request; zero if it isn't
+static u64 tx_transport_held_since_ns;
+// datagram being sent by the local transmitter and our position in it
+static struct seatalk_tx_datagram *tx_datagram = NULL;
+static int tx_byte_index;
+// 0 is the start bit, 1 to CHARACTER_DATA_BITS the data bits, then the stop bit
+static int tx_bit_index;
+// While hrtimer_txd is waiting to start a datagram this is the idle bus time (in bits) the datagram needs
+// before it may start. Negative once the datagram is under way
+static int tx_start_bits = -1;
+
+// Bus idle tracking
+// Guard time is measured from the end of the last character on the bus, not from when a transmitter is asked to
+// start, so a datagram queued after a long quiet period goes out at once. Every start bit accepted by
+// rxd_irq_handler (including the echo of our own characters) moves bus_busy_until to the end of that character's
+// stop bit. transmit_bit checks it again before sending a datagram's first bit, so a character that starts during
+// the wait pushes the transmission back automatically.
+// CLOCK_MONOTONIC nanoseconds; atomic so it can be read safely on 32-bit machines
+static atomic64_t bus_busy_until = ATOMIC64_INIT(0);
+
 // Linux High Resolution timer will be fired every BIT_INTERVAL nanoseconds while we are actively sending a byte
 // The timer is started by initiate_seatalk_hardware_transmitter() and is restarted after each firing until all bits in the data byte have been sent.
 // When the final bit is received the transport layer checks for new data in the transmit queue and restarts only if a queued datagram is present.
@@ -73,23 +177,120 @@ static struct hrtimer hrtimer_txd;
 // returns enum indicating whether to fire the timer again (restart) or to go idle
 static enum hrtimer_restart transmit_bit(struct hrtimer *timer);
 
+// Timed transmission
+// A datagram submitted with a target time waits in the queue until shortly before it (see
+// seatalk_hardware_tx_queue.c) and is then held by transmit_bit until the target itself. While the transmitter is
+// idle, hrtimer_tx_schedule wakes it when the earliest timed datagram becomes ready, or when the load governor will
+// let a datagram or transport layer request that it is holding back go.
+static struct hrtimer hrtimer_tx_schedule;
+
+// Collision detection
+// SeaTalk talkers must watch the line while sending and back off if another device pulls it low. With
+// tx_collision_detect set, hrtimer_tx_check samples the RxD line START_BIT_DELAY after every bit we drive and
+// compares it with what we drove. At the first mismatch the TxD line is released and stays released (tx_muted)
+// until the end of the datagram, so we stop corrupting the other talker's data.
+static bool tx_collision_detect = 0;
+module_param(tx_collision_detect, bool, 0644);
+MODULE_PARM_DESC(tx_collision_detect, "Read back every transmitted bit and abort on collision");
+static struct hrtimer hrtimer_tx_check;
+// the logic level most recently driven onto the line
+static int tx_driven_value = 1;
+// set by hrtimer_tx_check on collision, cleared by transmit_bit when it has dealt with it
+static int tx_collided = 0;
+// output is held at idle until the current datagram ends
+static int tx_muted = 0;
+
+// Collision recovery
+// A datagram cut short by a collision is kept and sent again by the hardware layer after a random backoff,
+// up to tx_collision_retries times, without a round trip through the transport layer. The backoff is measured
+// in bit times (like the bit_delay argument of seatalk_initiate_hardware_transmitter) and its random window
+// doubles with every collision the datagram suffers, up to a limit.
+// Transport layer datagrams are rebuilt from the bits the transport layer drove (see track_transmitted_bit) and
+// only reported through seatalk_transport_collision() if the hardware layer gives up on them.
+static int tx_collision_retries = 3;
+module_param(tx_collision_retries, int, 0644);
+MODULE_PARM_DESC(tx_collision_retries, "Number of times the hardware layer resends a datagram after a collision");
+// random part of the first backoff, in bits; doubles with every further collision up to BACKOFF_MAX_SHIFT times
+#define BACKOFF_WINDOW_BITS CHARACTER_BITS
+#define BACKOFF_MAX_SHIFT 4
+// set when the datagram currently being sent has collided
+static int tx_datagram_collided = 0;
+// rebuilt copy of the transport layer datagram on the wire
+static struct seatalk_tx_datagram transport_copy;
+
+// Transmitted character tracking
+// seatalk_set_hardware_bit_value follows every bit either transmitter asks for (even while tx_muted keeps it off
+// the line) and rebuilds the character being sent. Used for echo suppression and to copy transport layer datagrams.
+// data bits of the current character tracked so far; negative while waiting for a start bit
+static int tx_track_bits = -1;
+static int tx_track_character;
+
+// rxd_irq_handler accepted a start bit whose edge was at edge_ns. The bus is busy until the end of this character's stop bit
+static void character_started(u64 edge_ns) {
+  rx_character_start_ns = edge_ns;
+  atomic64_set(&bus_busy_until, edge_ns + (u64)READ_ONCE(rx_bit_interval) * CHARACTER_BITS);
+  seatalk_meter_character(edge_ns);
+}
+
+// record an RxD edge at edge_ns and return the level the line went to
+// Without edge capture the IRQ only fires on edges to logical 0 so the line is not read
+static int record_rx_edge(u64 edge_ns) {
+  int level = 0;
+
+  if (seatalk_edge_capture) {
+    level = seatalk_get_hardware_bit_value(SEATALK_PORT);
+    seatalk_capture_edge(edge_ns, level, 0);
+  }
+  seatalk_flight_record(edge_ns, SEATALK_FLIGHT_RX_EDGE, level);
+  if (edge_ns - irq_storm_window_start > IRQ_STORM_WINDOW_NS) {
+    irq_storm_window_start = edge_ns;
+    irq_storm_edges = 0;
+  }
+  // only reported once per window
+  if (++irq_storm_edges == IRQ_STORM_EDGES) {
+    seatalk_statistics.rx_irq_storms++;
+    seatalk_flight_freeze(SEATALK_FLIGHT_IRQ_STORM);
+  }
+  return level;
+}
+
 // interrupt requset handler triggered when the input signal line transitions from 0 to 1 (Logical Low to High)
 // When the bus is idle this indicates the start of a new data byte. When the bus is in some other state then this signal should be ignored.
 static irqreturn_t rxd_irq_handler(int irq, void *dev_id, struct pt_regs *regs) {
+  // read the clock before anything else so the timestamp is as close to the edge as we can get
+  u64 edge_ns = ktime_get_ns();
   unsigned long flags;
 
   // disable hardware interrupts to prevent re-entry into this IRQ handler
   local_irq_save(flags);
-  // debounce the state transition by ignoring IRQs for DEBOUNCE_NANOS nanoseconds after each "real" one
-  if (debouncing) {
+  // With edge capture on the IRQ fires on both edges. Only an edge to logical 0 can be a start bit.
+  // Otherwise, debounce the state transition by ignoring IRQs for DEBOUNCE_NANOS nanoseconds after each "real" one
+  if (record_rx_edge(edge_ns)) {
+    // back to idle level
+  } else if (debouncing) {
     pr_info("debouncing\n");
+  } else if (rx_echo) {
+    // level changes within our own echoed character are of no interest
+  } else if (suppress_tx_echo && READ_ONCE(tx_track_bits) == 0) {
+    // we have just driven a start bit so this is our own echo. Check it without involving seatalk_transport_layer.c
+    character_started(edge_ns);
+    rx_echo = 1;
+    rx_echo_mismatched = 0;
+    rx_bit_count = 0;
+    rx_sample_count = 0;
+    rx_character = 0;
+    hrtimer_start(&hrtimer_rxd, ktime_set(0, rx_bit_interval + rx_bit_interval / 4), HRTIMER_MODE_REL);
   } else {
     // seatalk_transport_layer.c manages the state logic around sending and receiving data so call into it
     // seatalk_initiate_receive_character returns truthy if we are starting a new byte
     if (seatalk_initiate_receive_character(SEATALK_PORT)) {
+      character_started(edge_ns);
+      rx_bit_count = 0;
+      rx_sample_count = 0;
+      rx_character = 0;
       // This 0 to 1 transition was a start bit so we schedule the receive event for first bit.
-      // Wait 1 bit timing plus a bit extra (START_BIT_DELAY) so that we sample the logic value after a debouncing period in order to account for slow logic level transitions
-      hrtimer_start(&hrtimer_rxd, ktime_set(0, BIT_INTERVAL + START_BIT_DELAY), HRTIMER_MODE_REL);
+      // Wait 1 bit timing plus a bit extra (START_BIT_DELAY, scaled with the bit timing) so that we sample the logic value after a debouncing period in order to account for slow logic level transitions
+      hrtimer_start(&hrtimer_rxd, ktime_set(0, rx_bit_interval + rx_bit_interval / 4), HRTIMER_MODE_REL);
     }
   }
   // restore hardware interrupts
@@ -100,20 +301,177 @@ static irqreturn_t rxd_irq_handler(int irq, void *dev_id, struct pt_regs *regs)
 
 // read the logic level from the input pin
 int seatalk_get_hardware_bit_value(int seatalk_port) {
+  if (simulate_line) {
+    return simulated_line_value;
+  }
   return gpio_get_value(GPIO_RXD_PIN) ? GPIO_RX_HIGH_VALUE : GPIO_RX_LOW_VALUE; // normal sense
 }
 
+// let go of the line after a collision
+static void release_line(void) {
+  if (simulate_line) {
+    simulated_line_value = 1;
+  } else {
+    gpio_set_value(GPIO_TXD_PIN, (1 == GPIO_TX_HIGH_VALUE) ? 1 : 0);
+  }
+}
+
+// someone else is holding the line low while we transmit. Stop driving at once; transmit_bit sorts out the rest at the next bit
+static void collision_detected(void) {
+  WRITE_ONCE(tx_muted, 1);
+  release_line();
+  WRITE_ONCE(tx_collided, 1);
+  seatalk_statistics.tx_collisions++;
+  seatalk_flight_freeze(SEATALK_FLIGHT_COLLISION);
+}
+
+// a character we transmitted is complete
+static void transmitted_character(int character) {
+  // keep a copy of transport layer datagrams in case they need resending after a collision
+  if (READ_ONCE(tx_owner) == TX_TRANSPORT && transport_copy.length < SEATALK_MAX_DATAGRAM_LENGTH) {
+    transport_copy.bytes[transport_copy.length++] = character & 0xff;
+  }
+}
+
+// follow the bits being transmitted and rebuild each character
+static void track_transmitted_bit(int bit_value) {
+  if (tx_track_bits < 0) {
+    // waiting for a start bit
+    if (!bit_value) {
+      tx_track_character = 0;
+      WRITE_ONCE(tx_track_bits, 0);
+    }
+  } else if (tx_track_bits < CHARACTER_DATA_BITS) {
+    tx_track_character |= bit_value << tx_track_bits;
+    WRITE_ONCE(tx_track_bits, tx_track_bits + 1);
+  } else {
+    // stop bit
+    WRITE_ONCE(tx_track_bits, -1);
+    transmitted_character(tx_track_character);
+  }
+}
+
 // write the desired logic level to the output pin
+static void drive_simulated_line(int level) {
+  int previous_level = simulated_line_value;
+
+  simulated_line_value = level;
+  // a high to low transition is what the RxD IRQ would have seen (and, with edge capture, low to high too)
+  if (previous_level != level && (!level || seatalk_edge_capture)) {
+    rxd_irq_handler(0, NULL, NULL);
+  }
+}
+
+int seatalk_line_simulated(void) {
+  return simulate_line;
+}
+
+int seatalk_inject_rx_level(int level) {
+  if (!simulate_line) {
+    return -ENODEV;
+  }
+  drive_simulated_line(level);
+  return 0;
+}
+
+void seatalk_set_rx_speed(int speed) {
+  WRITE_ONCE(rx_bit_interval, BIT_INTERVAL / speed);
+  WRITE_ONCE(rx_debounce_nanos, DEBOUNCE_NANOS / speed);
+}
+
 void seatalk_set_hardware_bit_value(int seatalk_port, int bit_value) {
+  track_transmitted_bit(bit_value);
+  // after a collision nothing more is driven until the datagram is over
+  if (READ_ONCE(tx_muted)) {
+    return;
+  }
+  if (bit_value != tx_driven_value) {
+    u64 now = ktime_get_ns();
+
+    seatalk_flight_record(now, SEATALK_FLIGHT_TX_LEVEL, bit_value);
+    if (seatalk_edge_capture && READ_ONCE(seatalk_edge_capture_tx)) {
+      seatalk_capture_edge(now, bit_value, 1);
+    }
+  }
+  tx_driven_value = bit_value;
+  if (simulate_line) {
+    drive_simulated_line(bit_value);
+    return;
+  }
   gpio_set_value(GPIO_TXD_PIN, (bit_value == GPIO_TX_HIGH_VALUE) ? 1 : 0); // normal sense
 //#ifdef DEBUG
 //  pr_info("set GPIO_TXD_PIN to %d\n", bit_value);
 //#endif
 }
 
+// pass a completed datagram to everything that wants received data
+static void deliver_datagram(const struct seatalk_datagram_record *datagram) {
+  seatalk_statistics.rx_datagrams++;
+  seatalk_meter_datagram(datagram->bytes[0]);
+  // in-kernel consumers first as they are the most latency sensitive
+  seatalk_consumer_deliver(datagram);
+  seatalk_latest_update(datagram);
+  seatalk_chardev_deliver(datagram);
+  seatalk_netdev_deliver(datagram);
+  seatalk_netlink_deliver(datagram);
+}
+
+// add a completed character to the datagram being assembled
+static void receive_character(int character) {
+  if (character & COMMAND_BIT) {
+    // first byte of a new datagram. Anything still being assembled was truncated and is discarded
+    if (rx_datagram.length) {
+      seatalk_statistics.rx_framing_errors++;
+      seatalk_flight_freeze(SEATALK_FLIGHT_FRAMING_ERROR);
+    }
+    rx_datagram.length = 0;
+    rx_datagram_expected_length = SEATALK_MAX_DATAGRAM_LENGTH;
+    rx_datagram.start_ns = rx_character_start_ns;
+    rx_datagram.start_tai_ns = 0;
+    if (rx_tai_timestamps) {
+      // convert rather than read CLOCK_TAI in the interrupt handler. The two clocks run at the same rate
+      rx_datagram.start_tai_ns = ktime_get_clocktai_ns() - (ktime_get_ns() - rx_character_start_ns);
+    }
+  } else if (rx_datagram.length == 0) {
+    // data byte without a command byte before it (probably started listening mid-datagram) so ignore it
+    return;
+  }
+  rx_datagram.bytes[rx_datagram.length++] = character & 0xff;
+  if (rx_datagram.length == 2) {
+    // low nibble of the attribute byte is the number of data bytes after the first one
+    rx_datagram_expected_length = 3 + (character & 0x0f);
+  }
+  if (rx_datagram.length == rx_datagram_expected_length) {
+    rx_datagram.timestamp_ns = rx_character_start_ns + (u64)rx_bit_interval * CHARACTER_BITS;
+    rx_datagram.port = SEATALK_PORT;
+    deliver_datagram(&rx_datagram);
+    rx_datagram.length = 0;
+  }
+}
+
+// compare the bit just sampled from our own echo with the one we drove
+// returns truthy if more bits of the echoed character are expected
+static int receive_echo_bit(void) {
+  int bit = rx_bit_count - 1;
+
+  // the transmitter drove this bit a quarter of a bit time ago so tx_track_character already has it
+  if (((rx_character ^ tx_track_character) >> bit) & 1 && !READ_ONCE(tx_muted)) {
+    if (tx_collision_detect) {
+      collision_detected();
+    } else if (!rx_echo_mismatched) {
+      rx_echo_mismatched = 1;
+      seatalk_statistics.rx_echo_mismatches++;
+    }
+  }
+  return rx_bit_count < CHARACTER_DATA_BITS;
+}
+
 // called by hrtimer_rxd when it expires
 // This function passes the receive data logic off to seatalk_transport_layer.c
 static enum hrtimer_restart receive_bit(struct hrtimer *timer) {
+  int more_bits;
+  int bit;
+
   // after a character has been received there is a rising-edge stop bit with a lot
   // of signal bounce. Wait DEBOUNCE_NANOS after the stop bit timing to ignore bounces
   if (debouncing) {
@@ -123,14 +481,41 @@ static enum hrtimer_restart receive_bit(struct hrtimer *timer) {
     return HRTIMER_NORESTART;
   } else {
     // calculate the wake-up time for the next bit now in case the receive bit logic runs a long time. Pretty much unnecessary except on the slowest of hardware but better safe than sorry.
-    hrtimer_forward_now(&hrtimer_rxd, ktime_set(0, BIT_INTERVAL));
-    // Dispatch seatalk_transport_layer.c logic to receive a single bit. A truthy return value indicates more bits are expected
-    if (seatalk_receive_bit(SEATALK_PORT)) {
+    hrtimer_forward_now(&hrtimer_rxd, ktime_set(0, rx_bit_interval));
+    bit = seatalk_get_hardware_bit_value(SEATALK_PORT);
+    seatalk_flight_record(ktime_get_ns(), SEATALK_FLIGHT_RX_SAMPLE, bit);
+    rx_sample_count++;
+    if (rx_bit_count < CHARACTER_DATA_BITS) {
+      // keep our own copy of the data bits for datagram tracking
+      rx_character |= bit << rx_bit_count++;
+    } else if (!bit) {
+      // the transport layer sampled the stop bit and it is not at idle level
+      seatalk_statistics.rx_framing_errors++;
+      seatalk_flight_freeze(SEATALK_FLIGHT_FRAMING_ERROR);
+    }
+    if (rx_echo) {
+      more_bits = receive_echo_bit();
+    } else {
+      // Dispatch seatalk_transport_layer.c logic to receive a single bit. A truthy return value indicates more bits are expected
+      more_bits = seatalk_receive_bit(SEATALK_PORT);
+    }
+    if (more_bits) {
       // more bits are expected. Restart the timer for one BIT_INTERVAL from now
       return HRTIMER_RESTART;
     } else {
-      // no more bits are expected. Restart the timer for DEBOUNCE_NANOS to force stop bit wobbles to be ignored by 0 to 1 logic level transition interrupt handler.
-      hrtimer_forward_now(&hrtimer_rxd, ktime_set(0, DEBOUNCE_NANOS));
+      // no more bits are expected so the character is complete
+      if (rx_echo) {
+        rx_echo = 0;
+        seatalk_statistics.rx_echo_suppressed++;
+      } else if (rx_sample_count != CHARACTER_DATA_BITS + 1) {
+        // the transport layer framed this character differently from us. Shorter ones are not delivered
+        seatalk_statistics.rx_decoder_mismatches++;
+      }
+      if (rx_bit_count == CHARACTER_DATA_BITS) {
+        receive_character(rx_character);
+      }
+      // Restart the timer for DEBOUNCE_NANOS to force stop bit wobbles to be ignored by 0 to 1 logic level transition interrupt handler.
+      hrtimer_forward_now(&hrtimer_rxd, ktime_set(0, rx_debounce_nanos));
       // Tell interrupt handler to ignore transitions
       debouncing = 1;
       return HRTIMER_RESTART;
@@ -138,63 +523,590 @@ static enum hrtimer_restart receive_bit(struct hrtimer *timer) {
   }
 }
 
+// send the next bit of the local transmitter's datagram
+// returns truthy if there are more bits to send
+// tx_lock must be held
+static int transmit_local_bit(void) {
+  int character = tx_datagram->bytes[tx_byte_index] | (tx_byte_index ? 0 : COMMAND_BIT);
+  int bit_value;
+
+  if (tx_bit_index == 0) {
+    bit_value = 0; // start bit
+  } else if (tx_bit_index <= CHARACTER_DATA_BITS) {
+    bit_value = (character >> (tx_bit_index - 1)) & 1;
+  } else {
+    bit_value = 1; // stop bit
+  }
+  seatalk_set_hardware_bit_value(SEATALK_PORT, bit_value);
+  if (++tx_bit_index < CHARACTER_BITS) {
+    return 1;
+  }
+  tx_bit_index = 0;
+  return ++tx_byte_index < tx_datagram->length;
+}
+
+// take the next local datagram of class lowest_class or above off the queue and make it current
+// returns 0 if none may start now
+// tx_lock must be held
+static int start_local_datagram(int lowest_class) {
+  tx_datagram = seatalk_tx_queue_pop(lowest_class);
+  if (!tx_datagram) {
+    return 0;
+  }
+  tx_byte_index = 0;
+  tx_bit_index = 0;
+  tx_owner = TX_LOCAL;
+  return 1;
+}
+
+// called by hrtimer_tx_check START_BIT_DELAY after each transmitted bit
+static enum hrtimer_restart check_transmitted_bit(struct hrtimer *timer) {
+  if (!READ_ONCE(tx_muted) && seatalk_get_hardware_bit_value(SEATALK_PORT) != tx_driven_value) {
+    collision_detected();
+  }
+  return HRTIMER_NORESTART;
+}
+
+// Tell seatalk_transport_layer.c that one of its datagrams was cut short by a collision and the hardware layer
+// did not manage to resend it, so it can decide what to do. The transport layer may provide its own definition;
+// the default does nothing.
+void __weak seatalk_transport_collision(int seatalk_port) {
+}
+
+// a collision was detected during the bit just sent
+// tx_lock must be held
+static void abort_after_collision(enum tx_owner owner) {
+  tx_datagram_collided = 1;
+  if (owner == TX_LOCAL) {
+    // stop sending the rest of the datagram
+    tx_byte_index = tx_datagram->length;
+    tx_bit_index = 0;
+  }
+}
+
+// start following a new transport layer datagram
+// tx_lock must be held
+static void reset_transport_copy(void) {
+  transport_copy.length = 0;
+}
+
+// random backoff, in bits, before another attempt at a datagram that has collided `collisions` times
+static int collision_backoff(int collisions) {
+  u32 window = BACKOFF_WINDOW_BITS << min(collisions - 1, BACKOFF_MAX_SHIFT);
+
+  return LOCAL_TX_GUARD_BITS + get_random_u32() % window;
+}
+
+// nanoseconds from now until the bus will have been idle for `bits` bit times (zero if it already has)
+static s64 bus_idle_delay(int bits) {
+  s64 delay = (s64)(atomic64_read(&bus_busy_until) + (u64)BIT_INTERVAL * bits - ktime_get_ns());
+
+  return delay > 0 ? delay : 0;
+}
+
+// the next datagram needs `bits` bit times of idle bus before it starts
+// returns the nanoseconds to wait before hrtimer_txd should fire for its first bit
+// tx_lock must be held
+static s64 datagram_start_delay(int bits) {
+  tx_start_bits = bits;
+  return bus_idle_delay(bits);
+}
+
+// the current datagram collided. Decide whether to send it again
+// returns the backoff in bits if it is to be resent (it stays current), otherwise a negative number
+// tx_lock must be held
+static int retry_after_collision(void) {
+  if (tx_owner == TX_TRANSPORT) {
+    // take over the transport layer's datagram if we managed to follow all of it
+    if (!tx_collision_retries || transport_copy.length < 3 || transport_copy.length != 3 + (transport_copy.bytes[1] & 0x0f)) {
+      return -1;
+    }
+    tx_datagram = kmalloc(sizeof(*tx_datagram), GFP_ATOMIC);
+    if (!tx_datagram) {
+      return -1;
+    }
+    *tx_datagram = transport_copy;
+    tx_datagram->class = SEATALK_TX_CLASS_DATA;
+    tx_datagram->target_ns = 0;
+    tx_datagram->started = 1;
+    tx_datagram->complete = NULL;
+    tx_datagram->collisions = 0;
+    tx_datagram->from_transport = 1;
+    tx_owner = TX_LOCAL;
+  }
+  if (++tx_datagram->collisions > tx_collision_retries) {
+    return -1;
+  }
+  seatalk_statistics.tx_retries++;
+  tx_byte_index = 0;
+  tx_bit_index = 0;
+  return collision_backoff(tx_datagram->collisions);
+}
+
+// the transmitter is going idle with nothing ready. Wake it when the next timed datagram is, or when the load
+// governor will let a held back datagram (the transport layer's included) go, if there is one
+// tx_lock must be held
+static void schedule_timed_wake(void) {
+  u64 ready = seatalk_tx_queue_next_ready();
+  u64 transport_ready;
+
+  if (tx_transport_pending_delay >= 0) {
+    transport_ready = ktime_get_ns() + max_t(s64, seatalk_governor_transport_delay(), 0);
+    if (!ready || transport_ready < ready) {
+      ready = transport_ready;
+    }
+  }
+  if (ready) {
+    hrtimer_start(&hrtimer_tx_schedule, ns_to_ktime(ready), HRTIMER_MODE_ABS);
+  }
+}
+
+// the bus is free. Decide who gets it next: alarms and commands, then a waiting transport layer request if the load
+// governor allows it, then the rest of the local queue
+// returns the guard time in bits before the next datagram starts, or a negative number if the transmitter has gone
+// idle (in which case hrtimer_tx_schedule has been set to wake it if anything is waiting)
+// tx_lock must be held
+static int choose_transmitter(void) {
+  int delay;
+  u64 now;
+
+  if (tx_transport_pending_delay >= 0) {
+    // the transport layer asked for the bus. Only alarms and commands go before it, and its request stays pending
+    // until they have gone
+    if (start_local_datagram(SEATALK_TX_CLASS_COMMAND)) {
+      return LOCAL_TX_GUARD_BITS;
+    }
+    now = ktime_get_ns();
+    if (seatalk_governor_transport_delay() <= 0) {
+      if (tx_transport_held_since_ns) {
+        seatalk_statistics.tx_transport_throttled_ns += now - tx_transport_held_since_ns;
+        tx_transport_held_since_ns = 0;
+      }
+      delay = tx_transport_pending_delay;
+      tx_transport_pending_delay = -1;
+      tx_owner = TX_TRANSPORT;
+      reset_transport_copy();
+      return delay;
+    }
+    // over the port-wide load limit. Nothing else local could go either
+    if (!tx_transport_held_since_ns) {
+      tx_transport_held_since_ns = now;
+    }
+  } else if (start_local_datagram(SEATALK_TX_CLASSES - 1)) {
+    return LOCAL_TX_GUARD_BITS;
+  }
+  tx_owner = TX_IDLE;
+  schedule_timed_wake();
+  return -1;
+}
+
+// a datagram has just finished. Decide who gets the bus next
+// returns the guard time in bits before the next datagram starts, or a negative number if the transmitter can go idle
+// *report_collision is set if seatalk_transport_collision() should be called once tx_lock is released
+// tx_lock must be held
+static int select_next_transmitter(int *report_collision) {
+  int delay;
+  int status = 0;
+
+  // the line is ours to drive again
+  WRITE_ONCE(tx_muted, 0);
+  *report_collision = 0;
+  if (tx_owner == TX_TRANSPORT) {
+    // the transport layer's datagrams are only known once sent, so they are paid for afterwards
+    seatalk_governor_charge_transport(transport_copy.length);
+  }
+  if (tx_datagram_collided) {
+    tx_datagram_collided = 0;
+    delay = retry_after_collision();
+    if (delay >= 0) {
+      return delay;
+    }
+    seatalk_statistics.tx_give_ups++;
+    status = -ECOMM;
+    *report_collision = (tx_owner == TX_TRANSPORT) || tx_datagram->from_transport;
+  }
+  if (tx_owner == TX_LOCAL) {
+    // this is called one bit time after the final stop bit was driven, so now is when it ended
+    seatalk_tx_complete(tx_datagram, status);
+    kfree(tx_datagram);
+    tx_datagram = NULL;
+  }
+  reset_transport_copy();
+  return choose_transmitter();
+}
+
 // called by hrtimer_txd when it expires
-// This function passes the transmit data logic off to seatalk_transport_layer.c
+// This function passes the transmit data logic off to seatalk_transport_layer.c, or sends the local transmitter's datagram
 static enum hrtimer_restart transmit_bit(struct hrtimer *timer) {
+  unsigned long flags;
+  enum tx_owner owner;
+  int more_bits = 0;
+  int collided;
+  int report_collision;
+  int guard_bits;
+  s64 delay;
+
   // calculate the wake-up time for the next bit (if any)
   // (done now to limit time lag on very slow machines)
   hrtimer_forward_now(&hrtimer_txd, ktime_set(0, BIT_INTERVAL));
-  // Dispatch seatalk_transport_layer.c logic to send a single bit. A truthy return value indicates there are more bits to send
-  if (seatalk_transmit_bit(SEATALK_PORT)) {
+  spin_lock_irqsave(&tx_lock, flags);
+  if (tx_start_bits >= 0) {
+    // about to send the first bit of a datagram. Make sure nobody has used the bus during the guard time
+    delay = bus_idle_delay(tx_start_bits);
+    if (delay > 0) {
+      spin_unlock_irqrestore(&tx_lock, flags);
+      seatalk_statistics.tx_start_deferrals++;
+      hrtimer_set_expires(timer, ktime_add_ns(hrtimer_cb_get_time(timer), delay));
+      return HRTIMER_RESTART;
+    }
+    if (tx_owner == TX_LOCAL && !tx_datagram->started && tx_datagram->target_ns) {
+      // a timed datagram goes at its target time and no sooner. The guard time is checked again when we wake
+      delay = (s64)(tx_datagram->target_ns - ktime_get_ns());
+      if (delay > 0) {
+        spin_unlock_irqrestore(&tx_lock, flags);
+        hrtimer_set_expires(timer, ktime_add_ns(hrtimer_cb_get_time(timer), delay));
+        return HRTIMER_RESTART;
+      }
+    }
+    if (tx_owner == TX_LOCAL && !tx_datagram->started) {
+      // the queue only hands out datagrams the load governor allows, so spend its budget now
+      tx_datagram->started = 1;
+      seatalk_governor_charge(tx_datagram);
+      seatalk_tx_queue_started(tx_datagram);
+    }
+    if (tx_owner == TX_LOCAL) {
+      // first bit of this attempt at the datagram
+      tx_datagram->start_ns = ktime_get_ns();
+    }
+    tx_start_bits = -1;
+  }
+  owner = tx_owner;
+  collided = READ_ONCE(tx_collided);
+  if (collided) {
+    WRITE_ONCE(tx_collided, 0);
+    abort_after_collision(owner);
+  }
+  if (owner == TX_LOCAL) {
+    more_bits = tx_byte_index < tx_datagram->length ? transmit_local_bit() : 0;
+  }
+  spin_unlock_irqrestore(&tx_lock, flags);
+  if (owner == TX_TRANSPORT) {
+    // Dispatch seatalk_transport_layer.c logic to send a single bit. A truthy return value indicates there are more bits to send
+    // (not called with tx_lock held in case it calls back into seatalk_initiate_hardware_transmitter)
+    // After a collision the transport layer is left to run to the end of its datagram but nothing reaches the line
+    more_bits = seatalk_transmit_bit(SEATALK_PORT);
+  }
+  if (more_bits) {
+    if (tx_collision_detect && !READ_ONCE(rx_echo) && !READ_ONCE(tx_muted)) {
+      // read back the bit we just drove once it has had time to settle
+      // (not needed while the receiver is checking the echo of this character)
+      hrtimer_start(&hrtimer_tx_check, ktime_set(0, START_BIT_DELAY), HRTIMER_MODE_REL);
+    }
     // more bits to send. Restart the timer for one BIT_INTERVAL from now
     return HRTIMER_RESTART;
-  } else {
+  }
+  // end of datagram. Hand the bus to whoever is waiting
+  spin_lock_irqsave(&tx_lock, flags);
+  guard_bits = select_next_transmitter(&report_collision);
+  delay = guard_bits < 0 ? -1 : datagram_start_delay(guard_bits);
+  spin_unlock_irqrestore(&tx_lock, flags);
+  if (report_collision) {
+    seatalk_transport_collision(SEATALK_PORT);
+  }
+  if (delay < 0) {
     // no more bits to send. Allow timer to idle. Transmission will need to be awakened with call to seatalk_initiate_hardware_transmitter() function (that call made by seatalk_transport_layer.c)
+    // or by a datagram being queued for the local transmitter
     return HRTIMER_NORESTART;
   }
+  hrtimer_set_expires(timer, ktime_add_ns(hrtimer_cb_get_time(timer), delay));
+  return HRTIMER_RESTART;
+}
+
+// queue a datagram to be sent by the hardware layer
+// check and copy a datagram for the local transmitter. Returns NULL and sets *status if it cannot be queued
+static struct seatalk_tx_datagram *new_datagram(int tx_class, const unsigned char *bytes, int length, int *status) {
+  struct seatalk_tx_datagram *datagram;
+
+  // the attribute byte must agree with the length
+  if (length < 3 || length > SEATALK_MAX_DATAGRAM_LENGTH || length != 3 + (bytes[1] & 0x0f)) {
+    *status = -EINVAL;
+    return NULL;
+  }
+  if (tx_class < 0 || tx_class >= SEATALK_TX_CLASSES) {
+    *status = -EINVAL;
+    return NULL;
+  }
+  datagram = kmalloc(sizeof(*datagram), GFP_ATOMIC);
+  if (!datagram) {
+    *status = -ENOMEM;
+    return NULL;
+  }
+  datagram->length = length;
+  memcpy(datagram->bytes, bytes, length);
+  datagram->class = tx_class;
+  datagram->target_ns = 0;
+  datagram->started = 0;
+  datagram->cookie = 0;
+  datagram->complete = NULL;
+  datagram->context = NULL;
+  datagram->collisions = 0;
+  datagram->from_transport = 0;
+  return datagram;
+}
+
+// queue a datagram and wake the transmitter if it is idle
+// returns as seatalk_tx_queue_push; the caller still owns the datagram unless 0 is returned
+// tx_lock must be held
+static int queue_datagram(struct seatalk_tx_datagram *datagram) {
+  int result = seatalk_tx_queue_push(datagram);
+  int guard_bits;
+
+  if (!result && tx_owner == TX_IDLE) {
+    // transmitter is idle so wake it. Otherwise the datagram is picked up when the current one finishes.
+    // Nothing may start if it is a timed datagram that is not ready yet or the load governor is holding back
+    guard_bits = choose_transmitter();
+    if (guard_bits >= 0) {
+      hrtimer_start(&hrtimer_txd, ns_to_ktime(datagram_start_delay(guard_bits)), HRTIMER_MODE_REL);
+    }
+  }
+  return result;
+}
+
+// called by hrtimer_tx_schedule when the earliest timed datagram becomes ready or the load governor allows more
+static enum hrtimer_restart wake_for_timed_datagram(struct hrtimer *timer) {
+  unsigned long flags;
+  int guard_bits;
+
+  spin_lock_irqsave(&tx_lock, flags);
+  // if the transmitter is busy it finds the datagram itself when the current one finishes
+  if (tx_owner == TX_IDLE) {
+    // may have been woken early, or the datagram may have been discarded, in which case this sleeps again
+    guard_bits = choose_transmitter();
+    if (guard_bits >= 0) {
+      hrtimer_start(&hrtimer_txd, ns_to_ktime(datagram_start_delay(guard_bits)), HRTIMER_MODE_REL);
+    }
+  }
+  spin_unlock_irqrestore(&tx_lock, flags);
+  return HRTIMER_NORESTART;
+}
+
+int seatalk_hardware_queue_datagram(int seatalk_port, int tx_class, const unsigned char *bytes, int length) {
+  struct seatalk_tx_datagram *datagram;
+  unsigned long flags;
+  int result;
+
+  // there is only the one port
+  if (seatalk_port != SEATALK_PORT) {
+    return -EINVAL;
+  }
+  datagram = new_datagram(tx_class, bytes, length, &result);
+  if (!datagram) {
+    return result;
+  }
+  spin_lock_irqsave(&tx_lock, flags);
+  result = queue_datagram(datagram);
+  spin_unlock_irqrestore(&tx_lock, flags);
+  if (result) {
+    kfree(datagram);
+    // replacing a waiting datagram counts as success
+    return result > 0 ? 0 : result;
+  }
+  return 0;
+}
+
+int seatalk_submit_batch(const struct seatalk_tx_request *requests, int count, seatalk_tx_complete_t complete, void *context) {
+  struct seatalk_tx_datagram *datagram, *next;
+  LIST_HEAD(batch);
+  unsigned long flags;
+  int queued = 0;
+  int status;
+  int i;
+
+  // check and allocate everything first so interrupts are only disabled for the queueing itself
+  for (i = 0; i < count; i++) {
+    datagram = new_datagram(requests[i].tx_class, requests[i].bytes, requests[i].length, &status);
+    if (!datagram) {
+      struct seatalk_tx_completion completion = { .cookie = requests[i].cookie, .status = status };
+
+      if (complete) {
+        complete(&completion, context);
+      }
+      continue;
+    }
+    datagram->cookie = requests[i].cookie;
+    datagram->target_ns = requests[i].target_ns;
+    datagram->complete = complete;
+    datagram->context = context;
+    list_add_tail(&datagram->list, &batch);
+  }
+  spin_lock_irqsave(&tx_lock, flags);
+  list_for_each_entry_safe(datagram, next, &batch, list) {
+    list_del(&datagram->list);
+    status = queue_datagram(datagram);
+    if (status < 0) {
+      seatalk_tx_complete(datagram, status);
+    } else {
+      queued++;
+    }
+    if (status) {
+      // either refused or (if positive) its contents and completion replaced a datagram already queued
+      kfree(datagram);
+    }
+  }
+  spin_unlock_irqrestore(&tx_lock, flags);
+  return queued;
 }
+EXPORT_SYMBOL_GPL(seatalk_submit_batch);
 
 // called from seatalk_transport_layer.c to start hrtimer_txd to begin sending a new data byte
+// Never waits for hrtimer_txd. tx_owner (under tx_lock) says who may arm the timer: it is only started from here
+// or seatalk_hardware_queue_datagram when the transmitter is TX_IDLE, and otherwise the running transmitter
+// picks the request up itself. transmit_bit only goes TX_IDLE under tx_lock just before returning
+// HRTIMER_NORESTART, and starting a timer whose callback is returning HRTIMER_NORESTART is safe.
 void seatalk_initiate_hardware_transmitter(int seatalk_port, int bit_delay) {
-  // Reawaken the transmittter. Wait bit_delay BIT_INTERVALS as guard time after the last byte (from any device) on the bus
-  // First step: stop pending timer (if any)
-  hrtimer_cancel(&hrtimer_txd);
-  // schedule new timer after delay period
-  hrtimer_start(&hrtimer_txd, ktime_set(0, BIT_INTERVAL * bit_delay), HRTIMER_MODE_REL);
+  unsigned long flags;
+  int guard_bits;
+
+  spin_lock_irqsave(&tx_lock, flags);
+  if (tx_owner == TX_IDLE) {
+    // Reawaken the transmittter, unless the load governor holds the request back (hrtimer_tx_schedule then wakes
+    // it) or a local alarm or command goes first. Wait until the bus has been idle for bit_delay BIT_INTERVALS as
+    // guard time after the last byte (from any device) on the bus
+    tx_transport_pending_delay = bit_delay;
+    guard_bits = choose_transmitter();
+    if (guard_bits >= 0) {
+      // schedule new timer for when the bus will have been idle for the delay period. This may be right away
+      hrtimer_start(&hrtimer_txd, ns_to_ktime(datagram_start_delay(guard_bits)), HRTIMER_MODE_REL);
+    }
+  } else if (tx_owner == TX_TRANSPORT && tx_start_bits >= 0) {
+    // still waiting for the guard time before the transport layer's datagram. Use the new one
+    tx_start_bits = bit_delay;
+    if (hrtimer_try_to_cancel(&hrtimer_txd) >= 0) {
+      hrtimer_start(&hrtimer_txd, ns_to_ktime(bus_idle_delay(bit_delay)), HRTIMER_MODE_REL);
+    }
+    // otherwise transmit_bit is running right now and checks the new guard time when it gets tx_lock
+  } else {
+    // a datagram is on the wire (or the local transmitter is waiting to send one). Record the request;
+    // transmit_bit hands the bus to the transport layer when the current datagram ends
+    tx_transport_pending_delay = bit_delay;
+  }
+  spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// set up everything deliver_datagram() hands datagrams to
+static int init_datagram_interfaces(void) {
+  if (seatalk_consumer_init()) {
+    goto cleanup;
+  }
+  if (seatalk_latest_init()) {
+    goto cleanup_consumer;
+  }
+  if (seatalk_chardev_init()) {
+    goto cleanup_latest;
+  }
+  if (seatalk_netdev_init()) {
+    goto cleanup_chardev;
+  }
+  if (seatalk_netlink_init()) {
+    goto cleanup_netdev;
+  }
+  if (seatalk_capture_init()) {
+    goto cleanup_netlink;
+  }
+  if (seatalk_replay_init()) {
+    goto cleanup_capture;
+  }
+  return 0;
+
+cleanup_capture:
+  seatalk_capture_exit();
+cleanup_netlink:
+  seatalk_netlink_exit();
+cleanup_netdev:
+  seatalk_netdev_exit();
+cleanup_chardev:
+  seatalk_chardev_exit();
+cleanup_latest:
+  seatalk_latest_exit();
+cleanup_consumer:
+  seatalk_consumer_exit();
+cleanup:
+  return -1;
+}
+
+// tear down everything init_datagram_interfaces() set up
+// the receive timer must already be stopped so nothing else can be delivered
+static void exit_datagram_interfaces(void) {
+  seatalk_replay_exit();
+  seatalk_capture_exit();
+  seatalk_netlink_exit();
+  seatalk_netdev_exit();
+  seatalk_chardev_exit();
+  seatalk_latest_exit();
+  seatalk_consumer_exit();
+}
+
+// release RxD and TxD pins (if we have them)
+static void free_hardware_pins(void) {
+  if (!simulate_line) {
+    gpio_free(GPIO_TXD_PIN);
+    gpio_free(GPIO_RXD_PIN);
+  }
 }
 
 // initialize the GPIO pins
 int seatalk_init_hardware_signal(void) {
   // initialize rx
-  // reserve GPIO_RXD_PIN (default GPIO 23)
-  if (gpio_request(GPIO_RXD_PIN, GPIO_RXD_DESC)) {
-    pr_info("Unable to request GPIO RxD pin %d", GPIO_RXD_PIN);
-    goto cleanup;
+  // reserve GPIO_RXD_PIN (default GPIO 23). Nothing to reserve when the line is simulated
+  if (!simulate_line) {
+    if (gpio_request(GPIO_RXD_PIN, GPIO_RXD_DESC)) {
+      pr_info("Unable to request GPIO RxD pin %d", GPIO_RXD_PIN);
+      goto cleanup;
+    }
+    // set pin direction to input
+    gpio_direction_input(GPIO_RXD_PIN);
   }
-  // set pin direction to input
-  gpio_direction_input(GPIO_RXD_PIN);
   // initialize the receive timer but don't start it
   hrtimer_init(&hrtimer_rxd, CLOCK_REALTIME, HRTIMER_MODE_REL);
   hrtimer_rxd.function = receive_bit;
 
   // initialize tx
   // reserve GPIO_TXD_PIN (default GPIO 24)
-  if (gpio_request(GPIO_TXD_PIN, GPIO_TXD_DESC)) {
-    pr_info("Unable to request GPIO TxD pin %d", GPIO_TXD_PIN);
-    goto cleanup_rx;
+  if (!simulate_line) {
+    if (gpio_request(GPIO_TXD_PIN, GPIO_TXD_DESC)) {
+      pr_info("Unable to request GPIO TxD pin %d", GPIO_TXD_PIN);
+      goto cleanup_rx;
+    }
+    // set pin direction to output
+    gpio_direction_output(GPIO_TXD_PIN, 1);
   }
-  // set pin direction to output
-  gpio_direction_output(GPIO_TXD_PIN, 1);
   // set at-rest pin value to high
   seatalk_set_hardware_bit_value(SEATALK_PORT, 1);
   // initialize the transmit timer bit don't start it
   hrtimer_init(&hrtimer_txd, CLOCK_REALTIME, HRTIMER_MODE_REL);
   hrtimer_txd.function = transmit_bit;
+  hrtimer_init(&hrtimer_tx_check, CLOCK_REALTIME, HRTIMER_MODE_REL);
+  hrtimer_tx_check.function = check_transmitted_bit;
+  hrtimer_init(&hrtimer_tx_schedule, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  hrtimer_tx_schedule.function = wake_for_timed_datagram;
+
+  // ways for the rest of the system to get at received datagrams
+  if (init_datagram_interfaces()) {
+    goto cleanup_tx;
+  }
+  // counters (failure here is not fatal)
+  seatalk_debugfs_init();
 
   return 0;
 
+cleanup_tx:
+  if (!simulate_line) {
+    gpio_free(GPIO_TXD_PIN);
+  }
 cleanup_rx:
-  gpio_free(GPIO_RXD_PIN);
+  if (!simulate_line) {
+    gpio_free(GPIO_RXD_PIN);
+  }
 cleanup:
   return -1;
 }
@@ -205,6 +1117,11 @@ short int gpio_rxd_irq = 0;
 
 // initialize the interrupt request handler for receiving data
 int seatalk_init_hardware_irq(void) {
+  // the simulated line calls rxd_irq_handler directly
+  if (simulate_line) {
+    pr_info("Using simulated Seatalk line");
+    return 0;
+  }
   // hook irq for RxD GPIO pin
   // get IRQ number for input pin
   if ((gpio_rxd_irq = gpio_to_irq(GPIO_RXD_PIN)) < 0) {
@@ -212,7 +1129,8 @@ int seatalk_init_hardware_irq(void) {
     goto cleanup;
   }
   // set up interrupt vector for START_BIT_DIRECTION (falling edge if using normal sense)
-  if (request_irq(gpio_rxd_irq, (irq_handler_t) rxd_irq_handler, START_BIT_DIRECTION, GPIO_RXD_DESC, GPIO_DEVICE_DESC)) {
+  // edge capture needs to see the line going back to idle as well
+  if (request_irq(gpio_rxd_irq, (irq_handler_t) rxd_irq_handler, seatalk_edge_capture ? (IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING) : START_BIT_DIRECTION, GPIO_RXD_DESC, GPIO_DEVICE_DESC)) {
     pr_info("Unable to request IRQ %d", gpio_rxd_irq);
     goto cleanup;
   }
@@ -221,24 +1139,47 @@ int seatalk_init_hardware_irq(void) {
   return 0;
 
 cleanup:
-  gpio_free(GPIO_TXD_PIN);
-  gpio_free(GPIO_RXD_PIN);
+  seatalk_debugfs_exit();
+  exit_datagram_interfaces();
+  free_hardware_pins();
   return -1;
 }
 
+// free the local transmitter's datagrams. Only called once hrtimer_txd has been cancelled
+static void discard_local_datagrams(void) {
+  seatalk_tx_queue_discard();
+  if (tx_datagram) {
+    seatalk_tx_complete(tx_datagram, -ECANCELED);
+  }
+  kfree(tx_datagram);
+  tx_datagram = NULL;
+  tx_owner = TX_IDLE;
+  tx_datagram_collided = 0;
+  tx_start_bits = -1;
+}
+
 // release the GPIO pins
 void seatalk_exit_hardware_signal(void) {
-  // release RxD and TxD pins
-  gpio_free(GPIO_TXD_PIN);
-  gpio_free(GPIO_RXD_PIN);
-  // cancel timers
+  // cancel timers. hrtimer_tx_schedule first as it can start hrtimer_txd
+  hrtimer_cancel(&hrtimer_tx_schedule);
   hrtimer_cancel(&hrtimer_rxd);
   hrtimer_cancel(&hrtimer_txd);
+  hrtimer_cancel(&hrtimer_tx_check);
+  // discard anything the local transmitter had not sent
+  discard_local_datagrams();
+  // nothing can be delivered any more so the interfaces can go
+  seatalk_debugfs_exit();
+  exit_datagram_interfaces();
+  // release RxD and TxD pins
+  free_hardware_pins();
   return;
 }
 
 // release the interrupt request handler
 void seatalk_exit_hardware_irq(void) {
+  if (simulate_line) {
+    return;
+  }
   // release IRQ
   free_irq(gpio_rxd_irq, GPIO_DEVICE_DESC);
 }
@@ -0,0 +1,172 @@
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// Bus utilization meter
+// Counts every character and datagram seen on the bus (ours included) into one slot per second, keeping the
+// last minute, so the debugfs bus_utilization file can report how busy the bus has been over the last 1, 10 and
+// 60 seconds, the character and datagram rates, the datagram rate for each command byte and a histogram of the
+// idle gaps between characters. Each character only costs a slot lookup and a few increments.
+// Utilization assumes each character occupies the bus for a full CHARACTER_BITS bit times.
+
+// longest window reported, in seconds
+#define METER_HISTORY 60
+// the seconds of the longest window plus the one still being counted, which would otherwise overwrite the oldest
+#define METER_SLOTS (METER_HISTORY + 1)
+// idle gap histogram buckets: 0 bits, then powers of two up to 2^(GAP_BUCKETS - 2) bits and over
+#define GAP_BUCKETS 16
+
+struct meter_slot {
+  // second (CLOCK_MONOTONIC) this slot holds counts for
+  u64 second;
+  u32 characters;
+  u32 datagrams;
+  // at most 4800 / CHARACTER_BITS / 3 datagrams fit in a second
+  u16 commands[256];
+};
+
+static const int meter_windows[] = { 1, 10, METER_HISTORY };
+
+// taken from interrupt and timer context
+static DEFINE_SPINLOCK(meter_lock);
+static struct meter_slot meter_slots[METER_SLOTS];
+// gaps between the end of one character and the start of the next, in bit times
+static u64 gap_histogram[GAP_BUCKETS];
+// CLOCK_MONOTONIC time the previous character ended; zero before the first
+static u64 last_character_end;
+
+// meter_lock must be held
+static struct meter_slot *current_slot(u64 now) {
+  u64 second = div_u64(now, NSEC_PER_SEC);
+  struct meter_slot *slot;
+  u32 index;
+
+  div_u64_rem(second, METER_SLOTS, &index);
+  slot = &meter_slots[index];
+  if (slot->second != second) {
+    // a minute (or more) old; start again
+    memset(slot, 0, sizeof(*slot));
+    slot->second = second;
+  }
+  return slot;
+}
+
+static int gap_bucket(u64 gap_bits) {
+  int bucket = gap_bits ? fls64(gap_bits) : 0;
+
+  return min(bucket, GAP_BUCKETS - 1);
+}
+
+void seatalk_meter_character(u64 start_ns) {
+  unsigned long flags;
+
+  spin_lock_irqsave(&meter_lock, flags);
+  current_slot(start_ns)->characters++;
+  if (last_character_end) {
+    // a start bit a little early (clock error or debounce) counts as no gap
+    u64 gap = start_ns > last_character_end ? start_ns - last_character_end : 0;
+
+    gap_histogram[gap_bucket(div_u64(gap, BIT_INTERVAL))]++;
+  }
+  last_character_end = start_ns + (u64)BIT_INTERVAL * CHARACTER_BITS;
+  spin_unlock_irqrestore(&meter_lock, flags);
+}
+
+void seatalk_meter_datagram(u8 command) {
+  unsigned long flags;
+  struct meter_slot *slot;
+
+  spin_lock_irqsave(&meter_lock, flags);
+  slot = current_slot(ktime_get_ns());
+  slot->datagrams++;
+  slot->commands[command]++;
+  spin_unlock_irqrestore(&meter_lock, flags);
+}
+
+// copied out of the live counters by seatalk_meter_show; too big for the stack
+struct meter_snapshot {
+  struct meter_slot slots[METER_SLOTS];
+  u64 gaps[GAP_BUCKETS];
+  u64 commands[256];
+};
+
+// print value / divisor with two decimal places
+static void seq_print_rate(struct seq_file *file, u64 value, u64 divisor) {
+  u64 hundredths = div64_u64(value * 100, divisor);
+
+  seq_printf(file, " %llu.%02llu", div_u64(hundredths, 100), hundredths - div_u64(hundredths, 100) * 100);
+}
+
+// debugfs bus_utilization
+// Only whole seconds are counted so the figures lag by up to a second.
+int seatalk_meter_show(struct seq_file *file, void *unused) {
+  struct meter_snapshot *snapshot;
+  struct meter_slot *slots;
+  u64 this_second = div_u64(ktime_get_ns(), NSEC_PER_SEC);
+  unsigned long flags;
+  int window;
+  int i;
+  int command;
+
+  // copy everything out so the lock is not held while formatting
+  snapshot = kzalloc(sizeof(*snapshot), GFP_KERNEL);
+  if (!snapshot) {
+    return -ENOMEM;
+  }
+  slots = snapshot->slots;
+  spin_lock_irqsave(&meter_lock, flags);
+  memcpy(slots, meter_slots, sizeof(meter_slots));
+  memcpy(snapshot->gaps, gap_histogram, sizeof(gap_histogram));
+  spin_unlock_irqrestore(&meter_lock, flags);
+
+  seq_puts(file, "window_s utilization_percent characters_per_s datagrams_per_s\n");
+  for (window = 0; window < ARRAY_SIZE(meter_windows); window++) {
+    u64 characters = 0;
+    u64 datagrams = 0;
+    int seconds = meter_windows[window];
+
+    for (i = 0; i < METER_SLOTS; i++) {
+      if (slots[i].second < this_second && slots[i].second + seconds >= this_second) {
+        characters += slots[i].characters;
+        datagrams += slots[i].datagrams;
+      }
+    }
+    seq_printf(file, "%d", seconds);
+    seq_print_rate(file, characters * CHARACTER_BITS * BIT_INTERVAL * 100, (u64)seconds * NSEC_PER_SEC);
+    seq_print_rate(file, characters, seconds);
+    seq_print_rate(file, datagrams, seconds);
+    seq_putc(file, '\n');
+  }
+
+  seq_puts(file, "\ncommand datagrams_per_s_60s\n");
+  for (i = 0; i < METER_SLOTS; i++) {
+    if (slots[i].second < this_second && slots[i].second + METER_HISTORY >= this_second) {
+      for (command = 0; command < 256; command++) {
+        snapshot->commands[command] += slots[i].commands[command];
+      }
+    }
+  }
+  for (command = 0; command < 256; command++) {
+    if (snapshot->commands[command]) {
+      seq_printf(file, "0x%02x", command);
+      seq_print_rate(file, snapshot->commands[command], METER_HISTORY);
+      seq_putc(file, '\n');
+    }
+  }
+
+  seq_puts(file, "\nidle_gap_bits count\n");
+  for (i = 0; i < GAP_BUCKETS; i++) {
+    if (i == 0) {
+      seq_printf(file, "0 %llu\n", snapshot->gaps[i]);
+    } else if (i == GAP_BUCKETS - 1) {
+      seq_printf(file, "%llu+ %llu\n", 1ULL << (i - 1), snapshot->gaps[i]);
+    } else {
+      seq_printf(file, "%llu-%llu %llu\n", 1ULL << (i - 1), (1ULL << i) - 1, snapshot->gaps[i]);
+    }
+  }
+  kfree(snapshot);
+  return 0;
+}
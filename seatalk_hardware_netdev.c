@@ -0,0 +1,174 @@
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/if_arp.h>
+#include "seatalk_hardware_gpio.h"
+
+// Network device
+// Optionally register a network interface (seatalk0) for the bus, in the same spirit as slcan does for CAN.
+// Each packet carries exactly one SeaTalk datagram starting with its command byte. Received datagrams are passed
+// up the stack so AF_PACKET sockets and tcpdump can capture them; packets sent to the interface go through the
+// normal qdisc and are handed to the hardware layer's transmit queue. The interface has one transmit queue per
+// transmit class, so when a class is full only that queue is stopped and its packets wait in the qdisc until the
+// transmitter takes one of the class's datagrams; the other classes keep moving.
+// Combine with the simulate_line module parameter for a loopback interface that needs no hardware.
+
+static bool network_device = 0;
+module_param(network_device, bool, 0444);
+MODULE_PARM_DESC(network_device, "Register a seatalk%d network interface for the bus");
+
+// there is no registered ethertype for SeaTalk so use the IEEE local experimental one
+#define ETH_P_SEATALK 0x88B5
+// shortest datagram is command byte, attribute byte and one data byte
+#define SEATALK_MIN_DATAGRAM_LENGTH 3
+
+static struct net_device *seatalk_netdev = NULL;
+
+// transmit class for each socket priority (SO_PRIORITY / TC_PRIO_*). Unmarked traffic is instrument data
+static const u8 priority_classes[] = {
+  SEATALK_TX_CLASS_DATA,     // TC_PRIO_BESTEFFORT
+  SEATALK_TX_CLASS_ROUTINE,  // TC_PRIO_FILLER
+  SEATALK_TX_CLASS_ROUTINE,  // TC_PRIO_BULK
+  SEATALK_TX_CLASS_DATA,
+  SEATALK_TX_CLASS_DATA,     // TC_PRIO_INTERACTIVE_BULK
+  SEATALK_TX_CLASS_DATA,
+  SEATALK_TX_CLASS_COMMAND,  // TC_PRIO_INTERACTIVE
+  SEATALK_TX_CLASS_ALARM,    // TC_PRIO_CONTROL
+};
+
+static int seatalk_netdev_open(struct net_device *dev) {
+  netif_tx_start_all_queues(dev);
+  return 0;
+}
+
+static int seatalk_netdev_stop(struct net_device *dev) {
+  netif_tx_stop_all_queues(dev);
+  return 0;
+}
+
+// the transmit queue, and so the transmit class, for a packet. Priorities beyond TC_PRIO_CONTROL, such as tc
+// class ids, are not ours to interpret and count as unmarked
+static u16 seatalk_netdev_select_queue(struct net_device *dev, struct sk_buff *skb, struct net_device *sb_dev) {
+  if (skb->priority >= ARRAY_SIZE(priority_classes)) {
+    return SEATALK_TX_CLASS_DATA;
+  }
+  return priority_classes[skb->priority];
+}
+
+static netdev_tx_t seatalk_netdev_start_xmit(struct sk_buff *skb, struct net_device *dev) {
+  u16 class = skb_get_queue_mapping(skb);
+  int result = skb_linearize(skb);
+
+  if (!result) {
+    result = seatalk_hardware_queue_datagram(0, class, skb->data, skb->len);
+  }
+  if (result == -ENOSPC) {
+    // the class is full. Hold its packets in the qdisc until seatalk_netdev_wake(), and try once more in case the
+    // transmitter made room before the queue was stopped
+    netif_stop_subqueue(dev, class);
+    result = seatalk_hardware_queue_datagram(0, class, skb->data, skb->len);
+    if (result == -ENOSPC) {
+      return NETDEV_TX_BUSY;
+    }
+    netif_wake_subqueue(dev, class);
+  }
+  if (result) {
+    dev->stats.tx_dropped++;
+  } else {
+    dev->stats.tx_packets++;
+    dev->stats.tx_bytes += skb->len;
+  }
+  consume_skb(skb);
+  return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops seatalk_netdev_ops = {
+  .ndo_open = seatalk_netdev_open,
+  .ndo_stop = seatalk_netdev_stop,
+  .ndo_start_xmit = seatalk_netdev_start_xmit,
+  .ndo_select_queue = seatalk_netdev_select_queue,
+};
+
+static void seatalk_netdev_setup(struct net_device *dev) {
+  dev->netdev_ops = &seatalk_netdev_ops;
+  dev->type = ARPHRD_NONE;
+  dev->flags = IFF_NOARP | IFF_POINTOPOINT;
+  dev->hard_header_len = 0;
+  dev->addr_len = 0;
+  dev->mtu = SEATALK_MAX_DATAGRAM_LENGTH;
+  dev->min_mtu = SEATALK_MIN_DATAGRAM_LENGTH;
+  dev->max_mtu = SEATALK_MAX_DATAGRAM_LENGTH;
+  // the bus moves roughly 40 datagrams a second so a short queue for each class is plenty
+  dev->tx_queue_len = 16;
+}
+
+void seatalk_netdev_deliver(const struct seatalk_datagram_record *record) {
+  struct net_device *dev = seatalk_netdev;
+  struct sk_buff *skb;
+
+  if (!dev || !netif_running(dev)) {
+    return;
+  }
+  skb = netdev_alloc_skb(dev, record->length);
+  if (!skb) {
+    dev->stats.rx_dropped++;
+    return;
+  }
+  skb_put_data(skb, record->bytes, record->length);
+  // both receive timestamps. The start bit edge of the command byte is the raw hardware timestamp
+  // (SOF_TIMESTAMPING_RAW_HARDWARE), whose clock is the device's own; here that is CLOCK_MONOTONIC. The end of the
+  // last stop bit is the software timestamp (SO_TIMESTAMP*, SOF_TIMESTAMPING_RX_SOFTWARE), on CLOCK_REALTIME as the
+  // stack expects, instead of the time the packet happened to reach netif_rx
+  skb_hwtstamps(skb)->hwtstamp = ns_to_ktime(record->start_ns);
+  skb->tstamp = ktime_mono_to_real(ns_to_ktime(record->timestamp_ns));
+  skb->protocol = htons(ETH_P_SEATALK);
+  skb->pkt_type = PACKET_HOST;
+  skb->ip_summed = CHECKSUM_UNNECESSARY;
+  skb_reset_mac_header(skb);
+  skb_reset_network_header(skb);
+  dev->stats.rx_packets++;
+  dev->stats.rx_bytes += record->length;
+  // safe from hard interrupt context
+  netif_rx(skb);
+}
+
+void seatalk_netdev_wake(int tx_class) {
+  struct net_device *dev = seatalk_netdev;
+
+  if (dev && __netif_subqueue_stopped(dev, tx_class)) {
+    netif_wake_subqueue(dev, tx_class);
+  }
+}
+
+int seatalk_netdev_init(void) {
+  struct net_device *dev;
+
+  if (!network_device) {
+    return 0;
+  }
+  dev = alloc_netdev_mqs(0, "seatalk%d", NET_NAME_ENUM, seatalk_netdev_setup, SEATALK_TX_CLASSES, 1);
+  if (!dev) {
+    pr_info("Unable to allocate Seatalk network device");
+    return -1;
+  }
+  if (register_netdev(dev)) {
+    pr_info("Unable to register Seatalk network device");
+    free_netdev(dev);
+    return -1;
+  }
+  seatalk_netdev = dev;
+  pr_info("Registered network device %s", dev->name);
+  return 0;
+}
+
+void seatalk_netdev_exit(void) {
+  struct net_device *dev = seatalk_netdev;
+
+  if (!dev) {
+    return;
+  }
+  seatalk_netdev = NULL;
+  unregister_netdev(dev);
+  free_netdev(dev);
+}
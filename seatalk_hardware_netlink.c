@@ -0,0 +1,138 @@
+#include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
+#include "seatalk_hardware_gpio.h"
+
+// Generic netlink family
+// Lets any number of processes share the received datagram stream. Each datagram is built into one message and
+// multicast once no matter how many sockets are subscribed. The same family accepts datagrams to transmit.
+//
+// Netlink broadcasts cannot be made from the receive timer, so completed datagrams are queued here and
+// multicast from a work item.
+
+// datagrams waiting to be multicast
+#define NETLINK_QUEUE_LENGTH 64
+
+// single producer (receive timer), single consumer (multicast_work)
+static DECLARE_KFIFO(netlink_queue, struct seatalk_datagram_record, NETLINK_QUEUE_LENGTH);
+static void multicast_datagrams(struct work_struct *work);
+static DECLARE_WORK(multicast_work, multicast_datagrams);
+static int netlink_registered = 0;
+
+static int seatalk_genl_transmit(struct sk_buff *skb, struct genl_info *info);
+
+static const struct nla_policy seatalk_genl_policy[SEATALK_ATTR_MAX + 1] = {
+  [SEATALK_ATTR_PORT] = { .type = NLA_U8 },
+  [SEATALK_ATTR_TIMESTAMP] = { .type = NLA_U64 },
+  [SEATALK_ATTR_DATA] = NLA_POLICY_MAX_LEN(SEATALK_MAX_DATAGRAM_LENGTH),
+  [SEATALK_ATTR_CLASS] = NLA_POLICY_MAX(NLA_U8, SEATALK_TX_CLASSES - 1),
+};
+
+static const struct genl_small_ops seatalk_genl_ops[] = {
+  {
+    .cmd = SEATALK_CMD_TRANSMIT,
+    .flags = GENL_ADMIN_PERM,
+    .doit = seatalk_genl_transmit,
+  },
+};
+
+static const struct genl_multicast_group seatalk_genl_groups[] = {
+  { .name = SEATALK_GENL_MCGRP_RX },
+};
+
+static struct genl_family seatalk_genl_family = {
+  .name = SEATALK_GENL_NAME,
+  .version = SEATALK_GENL_VERSION,
+  .maxattr = SEATALK_ATTR_MAX,
+  .policy = seatalk_genl_policy,
+  .module = THIS_MODULE,
+  .small_ops = seatalk_genl_ops,
+  .n_small_ops = ARRAY_SIZE(seatalk_genl_ops),
+  .resv_start_op = SEATALK_CMD_TRANSMIT + 1,
+  .mcgrps = seatalk_genl_groups,
+  .n_mcgrps = ARRAY_SIZE(seatalk_genl_groups),
+};
+
+static int seatalk_genl_transmit(struct sk_buff *skb, struct genl_info *info) {
+  struct nlattr *data = info->attrs[SEATALK_ATTR_DATA];
+  int port = 0;
+  int tx_class = SEATALK_TX_CLASS_DATA;
+
+  if (!data) {
+    return -EINVAL;
+  }
+  if (info->attrs[SEATALK_ATTR_PORT]) {
+    port = nla_get_u8(info->attrs[SEATALK_ATTR_PORT]);
+  }
+  if (info->attrs[SEATALK_ATTR_CLASS]) {
+    tx_class = nla_get_u8(info->attrs[SEATALK_ATTR_CLASS]);
+  }
+  return seatalk_hardware_queue_datagram(port, tx_class, nla_data(data), nla_len(data));
+}
+
+// build and multicast one message
+static void multicast_datagram(const struct seatalk_datagram_record *record) {
+  struct sk_buff *skb;
+  void *header;
+
+  skb = genlmsg_new(nla_total_size(sizeof(u8)) + 3 * nla_total_size_64bit(sizeof(u64)) + nla_total_size(record->length), GFP_KERNEL);
+  if (!skb) {
+    return;
+  }
+  header = genlmsg_put(skb, 0, 0, &seatalk_genl_family, 0, SEATALK_CMD_DATAGRAM);
+  if (!header) {
+    nlmsg_free(skb);
+    return;
+  }
+  if (nla_put_u8(skb, SEATALK_ATTR_PORT, record->port) ||
+      nla_put_u64_64bit(skb, SEATALK_ATTR_TIMESTAMP, record->timestamp_ns, SEATALK_ATTR_PAD) ||
+      nla_put_u64_64bit(skb, SEATALK_ATTR_START_TIMESTAMP, record->start_ns, SEATALK_ATTR_PAD) ||
+      (record->start_tai_ns && nla_put_u64_64bit(skb, SEATALK_ATTR_START_TAI, record->start_tai_ns, SEATALK_ATTR_PAD)) ||
+      nla_put(skb, SEATALK_ATTR_DATA, record->length, record->bytes)) {
+    genlmsg_cancel(skb, header);
+    nlmsg_free(skb);
+    return;
+  }
+  genlmsg_end(skb, header);
+  // consumes skb. Fails harmlessly if the last listener has just gone
+  genlmsg_multicast(&seatalk_genl_family, skb, 0, 0, GFP_KERNEL);
+}
+
+static void multicast_datagrams(struct work_struct *work) {
+  struct seatalk_datagram_record record;
+
+  while (kfifo_get(&netlink_queue, &record)) {
+    multicast_datagram(&record);
+  }
+}
+
+void seatalk_netlink_deliver(const struct seatalk_datagram_record *record) {
+  // don't bother queueing anything when nobody is subscribed
+  if (!netlink_registered || !genl_has_listeners(&seatalk_genl_family, &init_net, 0)) {
+    return;
+  }
+  // a full queue means the work item is badly behind so the datagram is dropped
+  if (kfifo_put(&netlink_queue, *record)) {
+    schedule_work(&multicast_work);
+  }
+}
+
+int seatalk_netlink_init(void) {
+  INIT_KFIFO(netlink_queue);
+  if (genl_register_family(&seatalk_genl_family)) {
+    pr_info("Unable to register generic netlink family %s", SEATALK_GENL_NAME);
+    return -1;
+  }
+  netlink_registered = 1;
+  return 0;
+}
+
+void seatalk_netlink_exit(void) {
+  if (!netlink_registered) {
+    return;
+  }
+  netlink_registered = 0;
+  cancel_work_sync(&multicast_work);
+  genl_unregister_family(&seatalk_genl_family);
+}
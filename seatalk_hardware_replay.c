@@ -0,0 +1,297 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// Replay injector
+// Plays an edge capture (the u64 edge format of struct seatalk_edge_ring, TxD edges are skipped) back into the
+// receiver through the simulated line, so field captures can be run through rxd_irq_handler and receive_bit as
+// regression tests. Needs simulate_line. Write the capture to debugfs replay, for example
+//   cat capture.edges > /sys/kernel/debug/seatalk/port0/replay
+// Playback starts with the first write and follows the capture's own timing divided by replay_speed; the receive
+// bit timing is scaled to match. Writers block while the queue is full. Decoded datagrams are delivered through
+// all the usual interfaces. debugfs replay_status reports progress, datagrams decoded and how late each edge
+// was injected compared with its scheduled time.
+// Captures written one after another (cat a.edges b.edges) go back in time where they join. The capture is
+// re-based at each such step so it carries on REPLAY_REBASE_GAP_NS after the edge before it.
+
+// edges buffered between the writer and the replay timer
+#define REPLAY_QUEUE_EDGES 16384
+// edges copied from userspace at a time
+#define REPLAY_CHUNK_EDGES 64
+// lead time before the first edge so the receiver is not caught mid-setup
+#define REPLAY_START_DELAY_NS 1000000
+// quiet time inserted where the capture's timestamps go backwards, long enough for the receiver to see the end of
+// any datagram cut short there
+#define REPLAY_REBASE_GAP_NS (10 * NSEC_PER_MSEC)
+
+static int replay_speed = 1;
+module_param(replay_speed, int, 0644);
+MODULE_PARM_DESC(replay_speed, "Speed-up factor when replaying an edge capture through debugfs (1 to 100)");
+
+static struct hrtimer hrtimer_replay;
+// replay_lock protects everything below. Taken from timer context
+static DEFINE_SPINLOCK(replay_lock);
+// only allocated when simulate_line is set
+static DECLARE_KFIFO_PTR(replay_queue, u64);
+static int replay_queue_allocated;
+static DECLARE_WAIT_QUEUE_HEAD(replay_wait);
+// only one writer at a time
+static DEFINE_MUTEX(replay_writer);
+static int replay_playing;
+// the writer has not finished yet, so an empty queue means we are waiting for more
+static int replay_writer_open;
+static int replay_active_speed;
+// CLOCK_MONOTONIC time at which the capture edge at replay_base_capture_ns is due
+static u64 replay_base_ns;
+static u64 replay_base_capture_ns;
+// added to each edge's time as it is queued to undo steps back in time; only used by the writer
+static u64 replay_capture_offset_ns;
+// re-based time of the last edge queued, zero before the first
+static u64 replay_last_capture_ns;
+
+// results of the current or last replay
+struct replay_results {
+  u64 edges;
+  u64 underruns;
+  u64 rebases;
+  u64 late_total_ns;
+  u64 late_max_ns;
+  u64 datagrams_at_start;
+  u64 framing_errors_at_start;
+  u64 datagrams;
+  u64 framing_errors;
+};
+static struct replay_results replay_results;
+
+static u64 edge_due(u64 edge) {
+  return replay_base_ns + div_u64(seatalk_edge_time(edge) - replay_base_capture_ns, replay_active_speed);
+}
+
+// replay_lock must be held
+static void replay_finished(void) {
+  replay_playing = 0;
+  replay_results.datagrams = seatalk_statistics.rx_datagrams - replay_results.datagrams_at_start;
+  replay_results.framing_errors = seatalk_statistics.rx_framing_errors - replay_results.framing_errors_at_start;
+  seatalk_set_rx_speed(1);
+}
+
+static enum hrtimer_restart replay_edge(struct hrtimer *timer) {
+  unsigned long flags;
+  u64 edge;
+  u64 due;
+  u64 now;
+  enum hrtimer_restart restart = HRTIMER_NORESTART;
+
+  spin_lock_irqsave(&replay_lock, flags);
+  // inject everything that is due, catching up if the timer was late
+  while (kfifo_peek(&replay_queue, &edge)) {
+    due = edge_due(edge);
+    now = ktime_get_ns();
+    if (due > now) {
+      hrtimer_set_expires(timer, ns_to_ktime(due));
+      restart = HRTIMER_RESTART;
+      break;
+    }
+    kfifo_skip(&replay_queue);
+    seatalk_inject_rx_level(edge & SEATALK_EDGE_LEVEL);
+    replay_results.edges++;
+    replay_results.late_total_ns += now - due;
+    if (now - due > replay_results.late_max_ns) {
+      replay_results.late_max_ns = now - due;
+    }
+  }
+  if (restart == HRTIMER_NORESTART) {
+    if (replay_writer_open) {
+      // the writer is not keeping up. replay_write restarts us with a new time base
+      replay_results.underruns++;
+      replay_playing = 0;
+    } else {
+      replay_finished();
+    }
+  }
+  spin_unlock_irqrestore(&replay_lock, flags);
+  wake_up_interruptible(&replay_wait);
+  return restart;
+}
+
+static int replay_open(struct inode *inode, struct file *file) {
+  if (!replay_queue_allocated) {
+    // only the simulated line can be driven
+    return -ENODEV;
+  }
+  if (!(file->f_mode & FMODE_WRITE)) {
+    return -EINVAL;
+  }
+  if (!mutex_trylock(&replay_writer)) {
+    return -EBUSY;
+  }
+  // a replay still playing out from the previous writer is abandoned
+  hrtimer_cancel(&hrtimer_replay);
+  spin_lock_irq(&replay_lock);
+  kfifo_reset(&replay_queue);
+  memset(&replay_results, 0, sizeof(replay_results));
+  replay_results.datagrams_at_start = seatalk_statistics.rx_datagrams;
+  replay_results.framing_errors_at_start = seatalk_statistics.rx_framing_errors;
+  replay_active_speed = clamp(READ_ONCE(replay_speed), 1, 100);
+  seatalk_set_rx_speed(replay_active_speed);
+  replay_writer_open = 1;
+  replay_playing = 0;
+  spin_unlock_irq(&replay_lock);
+  replay_capture_offset_ns = 0;
+  replay_last_capture_ns = 0;
+  // edges are a stream; there is nothing to seek
+  return stream_open(inode, file);
+}
+
+// the edge with its time moved on past any steps back in time earlier in the capture
+// replay_writer must be held
+static u64 replay_rebase(u64 edge) {
+  u64 time = seatalk_edge_time(edge) + replay_capture_offset_ns;
+
+  if (replay_last_capture_ns && time < replay_last_capture_ns) {
+    // otherwise edge_due() would wrap and the replay would wait forever
+    replay_capture_offset_ns += replay_last_capture_ns + REPLAY_REBASE_GAP_NS - time;
+    time = replay_last_capture_ns + REPLAY_REBASE_GAP_NS;
+    spin_lock_irq(&replay_lock);
+    replay_results.rebases++;
+    spin_unlock_irq(&replay_lock);
+  }
+  replay_last_capture_ns = time;
+  return time << SEATALK_EDGE_FLAG_BITS | (edge & (SEATALK_EDGE_LEVEL | SEATALK_EDGE_TX));
+}
+
+// start (or restart after an underrun) playing from the oldest queued edge
+// replay_lock must be held
+static void replay_start(void) {
+  u64 edge;
+
+  if (replay_playing || !kfifo_peek(&replay_queue, &edge)) {
+    return;
+  }
+  replay_base_capture_ns = seatalk_edge_time(edge);
+  replay_base_ns = ktime_get_ns() + REPLAY_START_DELAY_NS;
+  replay_playing = 1;
+  hrtimer_start(&hrtimer_replay, ns_to_ktime(replay_base_ns), HRTIMER_MODE_ABS);
+}
+
+static ssize_t replay_write(struct file *file, const char __user *buffer, size_t count, loff_t *offset) {
+  u64 chunk[REPLAY_CHUNK_EDGES];
+  size_t written = 0;
+  unsigned int edges;
+  unsigned int i;
+  unsigned int queued;
+
+  if (count % sizeof(u64)) {
+    return -EINVAL;
+  }
+  while (written < count) {
+    edges = min_t(size_t, (count - written) / sizeof(u64), REPLAY_CHUNK_EDGES);
+    if (copy_from_user(chunk, buffer + written, edges * sizeof(u64))) {
+      return written ? written : -EFAULT;
+    }
+    for (i = 0; i < edges; i++) {
+      if (!(chunk[i] & SEATALK_EDGE_TX)) {
+        chunk[i] = replay_rebase(chunk[i]);
+      }
+    }
+    i = 0;
+    while (i < edges) {
+      if (chunk[i] & SEATALK_EDGE_TX) {
+        // only what the receiver saw is replayed
+        i++;
+        continue;
+      }
+      if (wait_event_interruptible(replay_wait, !kfifo_is_full(&replay_queue))) {
+        return written ? written : -ERESTARTSYS;
+      }
+      spin_lock_irq(&replay_lock);
+      queued = kfifo_put(&replay_queue, chunk[i]);
+      replay_start();
+      spin_unlock_irq(&replay_lock);
+      i += queued;
+    }
+    written += edges * sizeof(u64);
+  }
+  return written;
+}
+
+static int replay_release(struct inode *inode, struct file *file) {
+  spin_lock_irq(&replay_lock);
+  replay_writer_open = 0;
+  if (!replay_playing) {
+    // everything has already been played (or nothing was written)
+    replay_finished();
+  }
+  spin_unlock_irq(&replay_lock);
+  mutex_unlock(&replay_writer);
+  return 0;
+}
+
+const struct file_operations seatalk_replay_fops = {
+  .owner = THIS_MODULE,
+  .open = replay_open,
+  .write = replay_write,
+  .release = replay_release,
+};
+
+int seatalk_replay_status_show(struct seq_file *file, void *unused) {
+  unsigned long flags;
+  int playing;
+  unsigned int queued;
+  struct replay_results results;
+
+  spin_lock_irqsave(&replay_lock, flags);
+  playing = replay_playing || replay_writer_open;
+  queued = kfifo_len(&replay_queue);
+  results = replay_results;
+  if (playing) {
+    results.datagrams = seatalk_statistics.rx_datagrams - results.datagrams_at_start;
+    results.framing_errors = seatalk_statistics.rx_framing_errors - results.framing_errors_at_start;
+  }
+  spin_unlock_irqrestore(&replay_lock, flags);
+
+  seq_printf(file, "state %s\n", playing ? "playing" : "idle");
+  seq_printf(file, "speed %d\n", replay_active_speed);
+  seq_printf(file, "edges_injected %llu\n", results.edges);
+  seq_printf(file, "edges_queued %u\n", queued);
+  seq_printf(file, "underruns %llu\n", results.underruns);
+  seq_printf(file, "rebases %llu\n", results.rebases);
+  seq_printf(file, "datagrams_decoded %llu\n", results.datagrams);
+  seq_printf(file, "framing_errors %llu\n", results.framing_errors);
+  seq_printf(file, "late_mean_ns %llu\n", results.edges ? div64_u64(results.late_total_ns, results.edges) : 0);
+  seq_printf(file, "late_max_ns %llu\n", results.late_max_ns);
+  return 0;
+}
+
+int seatalk_replay_init(void) {
+  hrtimer_init(&hrtimer_replay, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  hrtimer_replay.function = &replay_edge;
+  if (!seatalk_line_simulated()) {
+    return 0;
+  }
+  if (kfifo_alloc(&replay_queue, REPLAY_QUEUE_EDGES, GFP_KERNEL)) {
+    pr_info("Unable to allocate replay queue");
+    return -1;
+  }
+  replay_queue_allocated = 1;
+  return 0;
+}
+
+void seatalk_replay_exit(void) {
+  if (!replay_queue_allocated) {
+    return;
+  }
+  hrtimer_cancel(&hrtimer_replay);
+  seatalk_set_rx_speed(1);
+  kfifo_free(&replay_queue);
+  replay_queue_allocated = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef SEATALK_HARDWARE_SUBMIT_H
+#define SEATALK_HARDWARE_SUBMIT_H
+
+// In-kernel batched transmission
+// Other kernel modules can hand the hardware layer's transmitter a batch of datagrams in one call that returns
+// without waiting for any of them to be sent. The outcome of each one is reported through a completion callback
+// carrying the times it was on the wire (see struct seatalk_tx_completion in seatalk_hardware_gpio_uapi.h).
+//
+// complete() is called exactly once for every request:
+//  - before seatalk_submit_batch returns, if the request could not be queued
+//  - later, from the transmit timer in hard interrupt context with the transmitter's lock held, once the
+//    datagram has been sent, abandoned after collisions, replaced (tx_coalesce) or discarded on unload
+// It must not sleep and must not submit more datagrams. The context must stay valid until the last call.
+
+#include "seatalk_hardware_gpio_uapi.h"
+
+typedef void (*seatalk_tx_complete_t)(const struct seatalk_tx_completion *completion, void *context);
+
+// returns the number of requests queued. complete may be NULL
+int seatalk_submit_batch(const struct seatalk_tx_request *requests, int count, seatalk_tx_complete_t complete, void *context);
+
+#endif
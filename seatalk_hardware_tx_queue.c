@@ -0,0 +1,356 @@
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include "seatalk_hardware_gpio.h"
+
+// Local transmit queue
+// Datagrams waiting for the local transmitter are held in one queue per class (see enum seatalk_tx_class).
+// SEATALK_TX_CLASS_ALARM is always served first. By default the other classes are also served in strict
+// priority order; give any of them a weight through tx_class_weights and the lower classes instead share
+// the bus by deficit round robin in proportion to their weights, so routine traffic is never starved.
+// The transport layer ranks between commands and instrument data: when it is waiting for the bus the transmitter
+// only pops alarm and command datagrams ahead of it.
+//
+// With tx_coalesce set, a data or routine datagram with the same command byte as one already waiting in the same
+// class replaces the waiting one's contents in place. Producers such as speed and heading regenerate their values
+// faster than the bus can carry them; there is no point sending a backlog of outdated readings. Alarms and commands
+// are never coalesced: two keystrokes or two alarms with the same command byte are two different events.
+//
+// Datagrams with a target time are kept apart in target order. The first becomes ready TIMED_LOOKAHEAD_NS before
+// its target and then goes ahead of everything but alarms, so a long datagram from another class cannot start
+// just before the target and make it late. The transmitter holds it until the target itself.
+//
+// The bus load governor is applied when choosing: a class whose next datagram is over its own load limit is passed
+// over so it never holds up the classes behind it, and nothing is taken off the queue while the chosen datagram is
+// over the port-wide limit. seatalk_tx_queue_next_ready() says when to look again.
+//
+// Every function here must be called with the transmitter's tx_lock held.
+
+// maximum number of datagrams waiting in each class, so a flood of routine data cannot stop an alarm being queued
+#define TX_CLASS_QUEUE_LIMIT 16
+// deficit round robin credit, in characters, given to a class for each unit of weight
+#define TX_QUANTUM SEATALK_MAX_DATAGRAM_LENGTH
+// time to send the longest datagram
+#define TIMED_LOOKAHEAD_NS ((u64)SEATALK_MAX_DATAGRAM_LENGTH * CHARACTER_BITS * BIT_INTERVAL)
+
+static int tx_class_weights[SEATALK_TX_CLASSES];
+module_param_array(tx_class_weights, int, NULL, 0644);
+MODULE_PARM_DESC(tx_class_weights, "Weights for fair sharing between transmit classes below alarm (all zero for strict priority)");
+
+static bool tx_coalesce = 0;
+module_param(tx_coalesce, bool, 0644);
+MODULE_PARM_DESC(tx_coalesce, "Replace a queued data or routine datagram with a newer one of the same command byte instead of queueing both");
+
+static struct list_head class_queues[SEATALK_TX_CLASSES] = {
+  LIST_HEAD_INIT(class_queues[0]),
+  LIST_HEAD_INIT(class_queues[1]),
+  LIST_HEAD_INIT(class_queues[2]),
+  LIST_HEAD_INIT(class_queues[3]),
+};
+static int class_lengths[SEATALK_TX_CLASSES];
+// deficit round robin state
+static int class_deficits[SEATALK_TX_CLASSES];
+static int round_robin_class = SEATALK_TX_CLASS_ALARM + 1;
+// datagrams with a target time, earliest first
+static LIST_HEAD(timed_queue);
+static int timed_length;
+// when the port-wide load limit last stopped a datagram being popped, and when it will allow it
+static u64 throttled_since_ns;
+static u64 port_ready_ns;
+
+// keep timed_queue in target order. Searches from the back as datagrams are usually submitted in order
+static void insert_timed(struct seatalk_tx_datagram *datagram) {
+  struct seatalk_tx_datagram *queued;
+
+  list_for_each_entry_reverse(queued, &timed_queue, list) {
+    if (queued->target_ns <= datagram->target_ns) {
+      break;
+    }
+  }
+  list_add(&datagram->list, &queued->list);
+  timed_length++;
+}
+
+static int timed_ready(void) {
+  return timed_length && list_first_entry(&timed_queue, struct seatalk_tx_datagram, list)->target_ns <= ktime_get_ns() + TIMED_LOOKAHEAD_NS;
+}
+
+static struct seatalk_tx_datagram *class_head(int class) {
+  return list_first_entry(&class_queues[class], struct seatalk_tx_datagram, list);
+}
+
+// does the class have a datagram waiting that its own load limit lets go now?
+static int class_eligible(int class) {
+  return class_lengths[class] && !seatalk_governor_class_delay(class_head(class));
+}
+
+// the earliest timed datagram if it is ready, no lower than lowest_class and within its class's load limit,
+// otherwise NULL
+static struct seatalk_tx_datagram *timed_eligible(int lowest_class) {
+  struct seatalk_tx_datagram *datagram;
+
+  if (!timed_ready()) {
+    return NULL;
+  }
+  datagram = list_first_entry(&timed_queue, struct seatalk_tx_datagram, list);
+  return datagram->class > lowest_class || seatalk_governor_class_delay(datagram) ? NULL : datagram;
+}
+
+// is anything ready to go but for the load limits?
+static int waiting(void) {
+  int class;
+
+  if (timed_ready()) {
+    return 1;
+  }
+  for (class = 0; class < SEATALK_TX_CLASSES; class++) {
+    if (class_lengths[class]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// start or stop counting time in tx_throttled_ns
+static void set_throttled(int throttled, u64 now) {
+  if (throttled && !throttled_since_ns) {
+    throttled_since_ns = now;
+  } else if (!throttled && throttled_since_ns) {
+    seatalk_statistics.tx_throttled_ns += now - throttled_since_ns;
+    throttled_since_ns = 0;
+  }
+}
+
+// a datagram waiting in the same class with the same command byte, or NULL. Always NULL for alarms and commands
+static struct seatalk_tx_datagram *find_queued(const struct seatalk_tx_datagram *datagram) {
+  struct seatalk_tx_datagram *queued;
+
+  if (datagram->class < SEATALK_TX_CLASS_DATA) {
+    return NULL;
+  }
+  list_for_each_entry(queued, &class_queues[datagram->class], list) {
+    if (queued->bytes[0] == datagram->bytes[0]) {
+      return queued;
+    }
+  }
+  return NULL;
+}
+
+int seatalk_tx_queue_push(struct seatalk_tx_datagram *datagram) {
+  struct seatalk_tx_datagram *queued;
+
+  if (datagram->target_ns) {
+    // never coalesced; every one of them was asked for at its own time
+    if (timed_length >= SEATALK_TX_TIMED_MAX) {
+      return -ENOSPC;
+    }
+    datagram->enqueued_ns = ktime_get_ns();
+    insert_timed(datagram);
+    return 0;
+  }
+  if (READ_ONCE(tx_coalesce) && (queued = find_queued(datagram))) {
+    // keep the waiting datagram's place (and its enqueue time, so the latency figures stay honest)
+    seatalk_tx_complete(queued, -ECANCELED);
+    queued->length = datagram->length;
+    memcpy(queued->bytes, datagram->bytes, datagram->length);
+    queued->cookie = datagram->cookie;
+    queued->complete = datagram->complete;
+    queued->context = datagram->context;
+    seatalk_statistics.tx_coalesced++;
+    return 1;
+  }
+  if (class_lengths[datagram->class] >= TX_CLASS_QUEUE_LIMIT) {
+    return -ENOSPC;
+  }
+  datagram->enqueued_ns = ktime_get_ns();
+  list_add_tail(&datagram->list, &class_queues[datagram->class]);
+  class_lengths[datagram->class]++;
+  return 0;
+}
+
+u64 seatalk_tx_queue_next_ready(void) {
+  struct seatalk_tx_datagram *datagram;
+  u64 now = ktime_get_ns();
+  u64 ready = 0;
+  u64 at;
+  int class;
+
+  // each class's next datagram is ready once its load limits allow it
+  for (class = 0; class < SEATALK_TX_CLASSES; class++) {
+    if (class_lengths[class]) {
+      at = now + seatalk_governor_delay(class_head(class));
+      if (!ready || at < ready) {
+        ready = at;
+      }
+    }
+  }
+  if (timed_length) {
+    datagram = list_first_entry(&timed_queue, struct seatalk_tx_datagram, list);
+    at = max(datagram->target_ns > TIMED_LOOKAHEAD_NS ? datagram->target_ns - TIMED_LOOKAHEAD_NS : 0, now + seatalk_governor_delay(datagram));
+    if (!ready || at < ready) {
+      ready = at;
+    }
+  }
+  // and nothing at all goes before the port-wide limit allows the datagram that was chosen
+  if (ready && port_ready_ns > ready) {
+    ready = port_ready_ns;
+  }
+  return ready;
+}
+
+// are any of the classes below alarm weighted?
+static int weighted(void) {
+  int class;
+
+  for (class = SEATALK_TX_CLASS_ALARM + 1; class < SEATALK_TX_CLASSES; class++) {
+    if (READ_ONCE(tx_class_weights[class]) > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// deficit round robin over the classes below alarm, down to lowest_class. At least one of them must be eligible.
+// Returns the class to send from; its deficit is only spent once the datagram is actually taken
+static int choose_weighted(int lowest_class) {
+  int class;
+
+  for (;;) {
+    class = round_robin_class;
+    if (!class_lengths[class]) {
+      // idle classes do not save up credit
+      class_deficits[class] = 0;
+    } else if (class <= lowest_class && class_eligible(class)) {
+      if (class_deficits[class] >= class_head(class)->length) {
+        return class;
+      }
+      // unweighted classes still get a minimal share
+      class_deficits[class] += max(READ_ONCE(tx_class_weights[class]), 1) * TX_QUANTUM;
+    }
+    // classes over their load limit or out of range keep their credit for when they are allowed again
+    if (++round_robin_class == SEATALK_TX_CLASSES) {
+      round_robin_class = SEATALK_TX_CLASS_ALARM + 1;
+    }
+  }
+}
+
+struct seatalk_tx_datagram *seatalk_tx_queue_pop(int lowest_class) {
+  struct seatalk_tx_datagram *datagram = NULL;
+  u64 now = ktime_get_ns();
+  s64 delay;
+  int class = -1;
+
+  if (class_eligible(SEATALK_TX_CLASS_ALARM)) {
+    class = SEATALK_TX_CLASS_ALARM;
+  } else if (!(datagram = timed_eligible(lowest_class))) {
+    for (class = SEATALK_TX_CLASS_ALARM + 1; class <= lowest_class && !class_eligible(class); class++) {
+    }
+    if (class > lowest_class) {
+      if (lowest_class == SEATALK_TX_CLASSES - 1) {
+        // nothing ready, or everything waiting is over its class's load limit
+        port_ready_ns = 0;
+        set_throttled(waiting(), now);
+      }
+      return NULL;
+    }
+    if (weighted() && lowest_class > SEATALK_TX_CLASS_ALARM + 1) {
+      class = choose_weighted(lowest_class);
+    }
+  }
+  if (!datagram) {
+    datagram = class_head(class);
+  }
+  delay = seatalk_governor_port_delay(datagram);
+  if (delay > 0) {
+    port_ready_ns = now + delay;
+    set_throttled(1, now);
+    return NULL;
+  }
+  port_ready_ns = 0;
+  set_throttled(0, now);
+  list_del(&datagram->list);
+  if (datagram->target_ns) {
+    timed_length--;
+    return datagram;
+  }
+  if (class != SEATALK_TX_CLASS_ALARM && weighted()) {
+    class_deficits[class] -= datagram->length;
+  }
+  class_lengths[class]--;
+  seatalk_netdev_wake(class);
+  return datagram;
+}
+
+void seatalk_tx_queue_started(struct seatalk_tx_datagram *datagram) {
+  struct seatalk_tx_class_statistics *statistics = &seatalk_statistics.tx_classes[datagram->class];
+  u64 now = ktime_get_ns();
+  u64 latency = now - datagram->enqueued_ns;
+
+  if (datagram->target_ns) {
+    // the wait for the target time is not queueing latency. How late it went is what matters
+    latency = now > datagram->target_ns ? now - datagram->target_ns : 0;
+    seatalk_statistics.tx_timed++;
+    seatalk_statistics.tx_schedule_error_total_ns += latency;
+    if (latency > seatalk_statistics.tx_schedule_error_max_ns) {
+      seatalk_statistics.tx_schedule_error_max_ns = latency;
+    }
+    return;
+  }
+  statistics->sent++;
+  statistics->latency_total_ns += latency;
+  if (latency > statistics->latency_max_ns) {
+    statistics->latency_max_ns = latency;
+  }
+}
+
+void seatalk_tx_complete(struct seatalk_tx_datagram *datagram, int status) {
+  struct seatalk_tx_completion completion = {
+    .cookie = datagram->cookie,
+    .start_ns = datagram->started ? datagram->start_ns : 0,
+    .end_ns = status ? 0 : ktime_get_ns(),
+    .status = status,
+  };
+
+  if (datagram->complete) {
+    datagram->complete(&completion, datagram->context);
+  }
+}
+
+void seatalk_tx_queue_discard(void) {
+  struct seatalk_tx_datagram *datagram, *next;
+  int class;
+
+  for (class = 0; class < SEATALK_TX_CLASSES; class++) {
+    list_for_each_entry_safe(datagram, next, &class_queues[class], list) {
+      list_del(&datagram->list);
+      seatalk_tx_complete(datagram, -ECANCELED);
+      kfree(datagram);
+    }
+    class_lengths[class] = 0;
+    class_deficits[class] = 0;
+  }
+  list_for_each_entry_safe(datagram, next, &timed_queue, list) {
+    list_del(&datagram->list);
+    seatalk_tx_complete(datagram, -ECANCELED);
+    kfree(datagram);
+  }
+  timed_length = 0;
+  port_ready_ns = 0;
+  set_throttled(0, ktime_get_ns());
+}
+
+// debugfs tx_class_latency: enqueue-to-wire latency for each class
+int seatalk_tx_class_latency_show(struct seq_file *file, void *unused) {
+  int class;
+
+  seq_puts(file, "class sent mean_us max_us\n");
+  for (class = 0; class < SEATALK_TX_CLASSES; class++) {
+    const struct seatalk_tx_class_statistics *statistics = &seatalk_statistics.tx_classes[class];
+    u64 mean = statistics->sent ? div64_u64(statistics->latency_total_ns, statistics->sent) : 0;
+
+    seq_printf(file, "%d %llu %llu %llu\n", class, statistics->sent, div_u64(mean, NSEC_PER_USEC), div_u64(statistics->latency_max_ns, NSEC_PER_USEC));
+  }
+  return 0;
+}
@@ -0,0 +1,278 @@
+// seatalk_capture: log SeaTalk traffic from /dev/seatalk to a pcapng file (see seatalk_pcapng.h)
+//   seatalk_capture [-d] [-e] [-z resolution_ns] [-b bucket_ms] [-n] -w capture.pcapng
+// -d logs decoded datagrams and -e raw edges from the edge capture ring (load the driver with edge_capture=1).
+// -z logs edges in the compact form of seatalk_edge_codec.h instead, with times to within resolution_ns (1 keeps
+// them exact). With none of these, datagrams are logged. Stop with SIGINT or SIGTERM; every block is complete once
+// written.
+// An index (see seatalk_index.h) is written to capture.pcapng.idx as the capture goes, in buckets of bucket_ms
+// (default 1000) of traffic, for seatalk_query. -n leaves it out.
+//
+// Datagram blocks are written with writev straight out of the read() buffer and edge blocks after one copy out of
+// the mapped ring (or encoding from that copy). Edges are copied because the driver may overwrite them while the
+// write is in progress; seatalk_edges_read() drops any it catches being overwritten and they are reported in
+// epb_dropcount.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "../seatalk_hardware_gpio_uapi.h"
+#include "seatalk_pcapng.h"
+#include "seatalk_index.h"
+#include "seatalk_edge_codec.h"
+
+// datagrams read from /dev/seatalk at a time
+#define READ_RECORDS 64
+// how often the edge ring is drained. The ring holds several seconds of a busy bus
+#define POLL_INTERVAL_MS 50
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+// add to a CLOCK_MONOTONIC time to get CLOCK_REALTIME. Taken afresh for every batch so clock adjustments are followed
+static int64_t realtime_offset(void) {
+  struct timespec monotonic;
+  struct timespec realtime;
+
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  return (int64_t)(realtime.tv_sec - monotonic.tv_sec) * 1000000000 + (realtime.tv_nsec - monotonic.tv_nsec);
+}
+
+// one pcapng block per datagram, all in a single writev, then indexed
+static int write_datagrams(struct seatalk_pcapng_writer *writer, struct seatalk_index_writer *index, int device) {
+  static struct seatalk_datagram_record records[READ_RECORDS];
+  static struct seatalk_pcapng_packet_header headers[READ_RECORDS];
+  static struct seatalk_pcapng_packet_trailer trailers[READ_RECORDS];
+  static uint32_t block_lengths[READ_RECORDS];
+  struct iovec iov[READ_RECORDS * 3];
+  ssize_t length;
+  int count;
+  int i;
+  int64_t offset;
+  uint64_t start_ns;
+  uint64_t block;
+  int result;
+
+  length = read(device, records, sizeof(records));
+  if (length < 0) {
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+  }
+  count = length / sizeof(records[0]);
+  offset = realtime_offset();
+  for (i = 0; i < count; i++) {
+    start_ns = records[i].start_ns ? records[i].start_ns : records[i].timestamp_ns;
+    block_lengths[i] = seatalk_pcapng_packet(&headers[i], &trailers[i], SEATALK_PCAPNG_INTERFACE_DATAGRAMS, start_ns + offset, records[i].length, 0);
+    iov[i * 3].iov_base = &headers[i];
+    iov[i * 3].iov_len = sizeof(headers[i]);
+    iov[i * 3 + 1].iov_base = records[i].bytes;
+    iov[i * 3 + 1].iov_len = records[i].length;
+    iov[i * 3 + 2].iov_base = trailers[i].bytes;
+    iov[i * 3 + 2].iov_len = trailers[i].length;
+  }
+  if (!count) {
+    return 0;
+  }
+  block = writer->offset;
+  result = seatalk_pcapng_writev(writer, iov, count * 3);
+  for (i = 0; !result && index && i < count; i++) {
+    result = seatalk_index_add(index, block, block + block_lengths[i], (uint64_t)headers[i].timestamp_high << 32 | headers[i].timestamp_low, records[i].bytes[0]);
+    block += block_lengths[i];
+  }
+  return result;
+}
+
+// everything new in the edge ring, in blocks of up to SEATALK_PCAPNG_EDGES_PER_BLOCK edges. Compact blocks with
+// a non-zero resolution_ns
+static int write_edges(struct seatalk_pcapng_writer *writer, struct seatalk_index_writer *index, const struct seatalk_edge_ring *ring, uint64_t *position, uint32_t resolution_ns) {
+  static uint64_t edges[SEATALK_PCAPNG_EDGES_PER_BLOCK];
+  static uint8_t compact[SEATALK_EDGE_CODEC_MAX_BYTES(SEATALK_PCAPNG_EDGES_PER_BLOCK)];
+  struct seatalk_pcapng_packet_header header;
+  struct seatalk_pcapng_packet_trailer trailer;
+  struct iovec iov[3];
+  unsigned int count;
+  __u64 lost;
+  uint64_t block;
+  uint64_t timestamp_ns;
+  int result;
+
+  do {
+    count = seatalk_edges_read(ring, (__u64 *)position, (__u64 *)edges, SEATALK_PCAPNG_EDGES_PER_BLOCK, &lost);
+    if (!count) {
+      break;
+    }
+    timestamp_ns = seatalk_edge_time(edges[0]) + realtime_offset();
+    if (resolution_ns) {
+      iov[1].iov_base = compact;
+      iov[1].iov_len = seatalk_edge_encode(edges, count, resolution_ns, compact);
+      seatalk_pcapng_packet(&header, &trailer, SEATALK_PCAPNG_INTERFACE_COMPACT_EDGES, timestamp_ns, iov[1].iov_len, lost);
+    } else {
+      iov[1].iov_base = edges;
+      iov[1].iov_len = count * sizeof(edges[0]);
+      seatalk_pcapng_packet(&header, &trailer, SEATALK_PCAPNG_INTERFACE_EDGES, timestamp_ns, iov[1].iov_len, lost);
+    }
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[2].iov_base = trailer.bytes;
+    iov[2].iov_len = trailer.length;
+    block = writer->offset;
+    result = seatalk_pcapng_writev(writer, iov, 3);
+    if (!result && index) {
+      result = seatalk_index_add(index, block, writer->offset, timestamp_ns, -1);
+    }
+    if (result) {
+      return result;
+    }
+  } while (count == SEATALK_PCAPNG_EDGES_PER_BLOCK);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-d] [-e] [-z resolution_ns] [-b bucket_ms] [-n] -w capture.pcapng\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int option;
+  int datagrams = 0;
+  int edges = 0;
+  uint32_t resolution_ns = 0;
+  const char *path = NULL;
+  int indexed = 1;
+  uint64_t bucket_ns = SEATALK_INDEX_DEFAULT_BUCKET_NS;
+  char *index_path = NULL;
+  int index_fd = -1;
+  int device;
+  struct seatalk_pcapng_writer writer;
+  static struct seatalk_index_writer index;
+  const struct seatalk_edge_ring *ring = NULL;
+  uint64_t position = 0;
+  struct pollfd poll_device;
+  struct sigaction action;
+  struct seatalk_command_filter none;
+  int result = 0;
+
+  while ((option = getopt(argc, argv, "dez:b:nw:")) != -1) {
+    switch (option) {
+    case 'd':
+      datagrams = 1;
+      break;
+    case 'e':
+      edges = 1;
+      break;
+    case 'z':
+      resolution_ns = strtoul(optarg, NULL, 0);
+      if (!resolution_ns) {
+        usage(argv[0]);
+      }
+      edges = 1;
+      break;
+    case 'b':
+      bucket_ns = strtoull(optarg, NULL, 0) * 1000000;
+      break;
+    case 'n':
+      indexed = 0;
+      break;
+    case 'w':
+      path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (!path || optind != argc || !bucket_ns) {
+    usage(argv[0]);
+  }
+  if (!edges) {
+    datagrams = 1;
+  }
+
+  device = open("/dev/seatalk", O_RDONLY | O_NONBLOCK);
+  if (device < 0) {
+    perror("/dev/seatalk");
+    return 1;
+  }
+  if (!datagrams) {
+    // nobody will read them
+    memset(&none, 0, sizeof(none));
+    ioctl(device, SEATALK_IOC_SET_FILTER, &none);
+  }
+  if (edges) {
+    ring = mmap(NULL, SEATALK_EDGE_RING_SIZE, PROT_READ, MAP_SHARED, device, SEATALK_MMAP_EDGES_OFFSET);
+    if (ring == MAP_FAILED) {
+      perror("edge capture ring (is the driver loaded with edge_capture=1?)");
+      return 1;
+    }
+    // start from now, not from whatever history the ring still holds
+    position = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  }
+  writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (writer.fd < 0) {
+    perror(path);
+    return 1;
+  }
+  writer.offset = 0;
+  result = seatalk_pcapng_start(&writer);
+  if (!result && indexed) {
+    index_path = malloc(strlen(path) + 5);
+    if (!index_path) {
+      perror("malloc");
+      return 1;
+    }
+    sprintf(index_path, "%s.idx", path);
+    index_fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (index_fd < 0) {
+      perror(index_path);
+      return 1;
+    }
+    result = seatalk_index_start(&index, index_fd, bucket_ns);
+  }
+
+  memset(&action, 0, sizeof(action));
+  // no SA_RESTART so poll() returns at once
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  poll_device.fd = device;
+  poll_device.events = datagrams ? POLLIN : 0;
+  while (!result && !stopping) {
+    poll(&poll_device, 1, POLL_INTERVAL_MS);
+    if (datagrams) {
+      result = write_datagrams(&writer, indexed ? &index : NULL, device);
+    }
+    if (!result && edges) {
+      result = write_edges(&writer, indexed ? &index : NULL, ring, &position, resolution_ns);
+    }
+  }
+  if (!result && edges) {
+    // whatever arrived while we were stopping
+    result = write_edges(&writer, indexed ? &index : NULL, ring, &position, resolution_ns);
+  }
+  if (!result && indexed) {
+    result = seatalk_index_finish(&index);
+  }
+  if (result) {
+    fprintf(stderr, "%s: %s\n", path, strerror(-result));
+  }
+  close(writer.fd);
+  if (index_fd >= 0) {
+    close(index_fd);
+  }
+  free(index_path);
+  close(device);
+  return result ? 1 : 0;
+}
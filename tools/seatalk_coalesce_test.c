@@ -0,0 +1,125 @@
+// seatalk_coalesce_test: check which transmit classes tx_coalesce replaces queued datagrams in
+//   seatalk_coalesce_test
+// Needs the driver loaded with tx_coalesce=1, and with simulate_line=1 unless a real bus is to be used, and no
+// tx_load_limit. Submitting needs CAP_NET_ADMIN. Submits one batch: a datagram to keep the transmitter busy, then two
+// datagrams with the same command byte in each class. Only the first data and the first routine datagram may be
+// replaced (completed with -ECANCELED); both alarms and both autopilot keystrokes must be sent. Prints each datagram
+// that ended otherwise and exits 1 if there were any.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "../seatalk_hardware_gpio_uapi.h"
+
+// give up on completions after this long; the whole batch takes well under a second at 4800 baud
+#define TIMEOUT_MS 5000
+
+struct test_datagram {
+  const char *name;
+  int tx_class;
+  uint8_t length;
+  uint8_t bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  // status the completion must carry
+  int status;
+};
+
+static const struct test_datagram tests[] = {
+  // sent at once, so everything after it waits in the queue
+  { "busy (water temperature)", SEATALK_TX_CLASS_DATA, 4, { 0x27, 0x01, 0x00, 0x01 }, 0 },
+  { "first speed", SEATALK_TX_CLASS_DATA, 4, { 0x20, 0x01, 0x10, 0x00 }, -ECANCELED },
+  { "second speed", SEATALK_TX_CLASS_DATA, 4, { 0x20, 0x01, 0x20, 0x00 }, 0 },
+  { "first apparent wind speed", SEATALK_TX_CLASS_ROUTINE, 4, { 0x11, 0x01, 0x05, 0x00 }, -ECANCELED },
+  { "second apparent wind speed", SEATALK_TX_CLASS_ROUTINE, 4, { 0x11, 0x01, 0x06, 0x00 }, 0 },
+  { "first man overboard", SEATALK_TX_CLASS_ALARM, 10, { 0x6e, 0x07 }, 0 },
+  { "second man overboard", SEATALK_TX_CLASS_ALARM, 10, { 0x6e, 0x07 }, 0 },
+  { "keystroke -1", SEATALK_TX_CLASS_COMMAND, 4, { 0x86, 0x11, 0x05, 0xfa }, 0 },
+  { "keystroke +1", SEATALK_TX_CLASS_COMMAND, 4, { 0x86, 0x11, 0x07, 0xf8 }, 0 },
+};
+
+#define TESTS (sizeof(tests) / sizeof(tests[0]))
+
+int main(void) {
+  int device;
+  struct seatalk_command_filter none;
+  struct seatalk_completion_ring *ring;
+  struct seatalk_tx_request requests[TESTS];
+  struct seatalk_tx_batch batch;
+  struct pollfd poll_device;
+  const struct seatalk_tx_completion *completion;
+  int statuses[TESTS];
+  int completed[TESTS];
+  unsigned int done = 0;
+  unsigned int failed = 0;
+  uint32_t tail;
+  unsigned int i;
+
+  device = open("/dev/seatalk", O_RDWR);
+  if (device < 0) {
+    perror("/dev/seatalk");
+    return 1;
+  }
+  // only completions are wanted
+  memset(&none, 0, sizeof(none));
+  ioctl(device, SEATALK_IOC_SET_FILTER, &none);
+  ring = mmap(NULL, SEATALK_COMPLETION_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, device, SEATALK_MMAP_COMPLETION_OFFSET);
+  if (ring == MAP_FAILED) {
+    perror("completion ring");
+    return 1;
+  }
+  tail = ring->tail;
+
+  memset(requests, 0, sizeof(requests));
+  for (i = 0; i < TESTS; i++) {
+    requests[i].cookie = i;
+    requests[i].tx_class = tests[i].tx_class;
+    requests[i].length = tests[i].length;
+    memcpy(requests[i].bytes, tests[i].bytes, tests[i].length);
+    completed[i] = 0;
+  }
+  batch.requests = (uintptr_t)requests;
+  batch.count = TESTS;
+  // all in one call so nothing but the first can be sent before the rest are queued
+  if (ioctl(device, SEATALK_IOC_SUBMIT, &batch)) {
+    perror("SEATALK_IOC_SUBMIT");
+    return 1;
+  }
+
+  poll_device.fd = device;
+  poll_device.events = POLLPRI;
+  while (done < TESTS) {
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) && poll(&poll_device, 1, TIMEOUT_MS) <= 0) {
+      fprintf(stderr, "timed out with %u of %u datagrams completed\n", done, (unsigned int)TESTS);
+      return 1;
+    }
+    while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+      completion = &ring->entries[tail % SEATALK_COMPLETION_ENTRIES];
+      if (completion->cookie < TESTS && !completed[completion->cookie]) {
+        statuses[completion->cookie] = completion->status;
+        completed[completion->cookie] = 1;
+        done++;
+      }
+      tail++;
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+  }
+
+  for (i = 0; i < TESTS; i++) {
+    if (statuses[i] != tests[i].status) {
+      printf("%s: expected %s, got %s\n", tests[i].name, tests[i].status ? strerror(-tests[i].status) : "sent", statuses[i] ? strerror(-statuses[i]) : "sent");
+      failed++;
+    }
+  }
+  if (failed) {
+    printf("%u of %u datagrams ended wrongly. Is the driver loaded with tx_coalesce=1?\n", failed, (unsigned int)TESTS);
+    return 1;
+  }
+  printf("ok: only data and routine datagrams were replaced\n");
+  return 0;
+}
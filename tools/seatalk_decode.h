@@ -0,0 +1,303 @@
+#ifndef SEATALK_DECODE_H
+#define SEATALK_DECODE_H
+
+// Offline decoder for oversampled captures of the SeaTalk line
+// A capture is a packed bitmap of line samples taken at a fixed rate: sample n is bit n % 64 of word n / 64.
+// Characters are found with the same rules as rxd_irq_handler and receive_bit in seatalk_hardware_layer.c:
+//  - a start bit is an edge from logical 1 (idle) to logical 0
+//  - the 9 data bits (8 bits least significant first, then the command bit) are sampled SEATALK_BIT_INTERVAL_NS +
+//    SEATALK_SAMPLE_DELAY_NS after the edge and every SEATALK_BIT_INTERVAL_NS after that, followed by the stop
+//    bit, which must be 1
+//  - edges are ignored until SEATALK_DEBOUNCE_NS after the stop bit sample
+// Captures taken from the RxD pin through the level translator in the hardware schematic are inverted (logical 0
+// reads as 1, see GPIO_RX_LOW_VALUE); pass inverted = 1 for those.
+//
+// Nearly all the work is looking for start bits, so the scan runs over whole 64-bit words, several at once with
+// SSE2 or AVX2 where the processor has them. Each character found then costs ten single-bit reads.
+// seatalk_decode_characters() picks the fastest scan available; the _reference, _scalar, _sse2 and _avx2 variants
+// are there for benchmarking and all return identical results.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "../seatalk_hardware_gpio_uapi.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEATALK_DECODE_X86 1
+#endif
+
+// samples taken per character: 9 data bits and the stop bit
+#define SEATALK_DECODE_SAMPLES 10
+#define SEATALK_DECODE_DATA_BITS 9
+#define SEATALK_DECODE_COMMAND_BIT 0x100
+
+struct seatalk_decoder {
+  // XORed with every sample word to give logical levels
+  uint64_t invert_mask;
+  // samples from the start edge to each bit sample
+  uint32_t sample_offsets[SEATALK_DECODE_SAMPLES];
+  // samples from the start edge until the next one may be accepted
+  uint32_t resume_offset;
+  double samples_per_second;
+};
+
+struct seatalk_decoded_character {
+  // sample number of the start bit edge
+  uint64_t sample;
+  // 8 data bits and the command bit (SEATALK_DECODE_COMMAND_BIT)
+  uint16_t character;
+  // the stop bit was sampled at 0
+  uint8_t framing_error;
+  // always zero, so decoded characters can be compared with memcmp()
+  uint8_t reserved[5];
+};
+
+// samples_per_second must be at least a few times the 4800 bit/s line rate
+static inline void seatalk_decoder_init(struct seatalk_decoder *decoder, double samples_per_second, int inverted) {
+  double samples_per_ns = samples_per_second / 1e9;
+  int bit;
+
+  decoder->invert_mask = inverted ? ~(uint64_t)0 : 0;
+  for (bit = 0; bit < SEATALK_DECODE_SAMPLES; bit++) {
+    decoder->sample_offsets[bit] = ((double)SEATALK_BIT_INTERVAL_NS * (bit + 1) + SEATALK_SAMPLE_DELAY_NS) * samples_per_ns + 0.5;
+  }
+  decoder->resume_offset = ((double)SEATALK_BIT_INTERVAL_NS * SEATALK_DECODE_SAMPLES + SEATALK_SAMPLE_DELAY_NS + SEATALK_DEBOUNCE_NS) * samples_per_ns + 0.5;
+  decoder->samples_per_second = samples_per_second;
+}
+
+// logical level of one sample
+static inline int seatalk_decode_sample(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t sample) {
+  return ((samples[sample / 64] ^ decoder->invert_mask) >> (sample % 64)) & 1;
+}
+
+// logical 1 to 0 edges in word w: bit n is set if sample 64w + n - 1 is 1 and sample 64w + n is 0.
+// The sample before the capture counts as idle
+static inline uint64_t seatalk_decode_start_edges(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t w) {
+  uint64_t current = samples[w] ^ decoder->invert_mask;
+  uint64_t previous = w ? (samples[w - 1] ^ decoder->invert_mask) >> 63 : 1;
+
+  return ((current << 1) | previous) & ~current;
+}
+
+// first start edge in words [w, words), masking off samples before from in word w. Returns its sample number or
+// UINT64_MAX if there is none
+static inline uint64_t seatalk_decode_scan_words(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t w, uint64_t words, uint64_t from) {
+  uint64_t edges;
+
+  for (; w < words; w++) {
+    edges = seatalk_decode_start_edges(decoder, samples, w);
+    if (w == from / 64) {
+      edges &= ~(uint64_t)0 << (from % 64);
+    }
+    if (edges) {
+      return w * 64 + __builtin_ctzll(edges);
+    }
+  }
+  return UINT64_MAX;
+}
+
+// the slow way: one sample at a time
+static inline uint64_t seatalk_decode_find_reference(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t from) {
+  int previous = from ? seatalk_decode_sample(decoder, samples, from - 1) : 1;
+  int current;
+
+  for (; from < count; from++) {
+    current = seatalk_decode_sample(decoder, samples, from);
+    if (previous && !current) {
+      return from;
+    }
+    previous = current;
+  }
+  return UINT64_MAX;
+}
+
+static inline uint64_t seatalk_decode_find_scalar(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t from) {
+  return seatalk_decode_scan_words(decoder, samples, from / 64, (count + 63) / 64, from);
+}
+
+#ifdef SEATALK_DECODE_X86
+// two words at a time. Loading one word back gives each lane the word before it, so no shuffles are needed
+__attribute__((target("sse2")))
+static inline uint64_t seatalk_decode_find_sse2(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t from) {
+  uint64_t words = (count + 63) / 64;
+  uint64_t w = from / 64;
+  __m128i invert = _mm_set1_epi64x(decoder->invert_mask);
+  __m128i current;
+  __m128i previous;
+  __m128i edges;
+  uint64_t found;
+
+  // the first word is partly masked and needs the idle sample before the capture; do it the scalar way
+  found = seatalk_decode_scan_words(decoder, samples, w, w + 1 < words ? w + 1 : words, from);
+  if (found != UINT64_MAX) {
+    return found;
+  }
+  for (w++; w + 2 <= words; w += 2) {
+    current = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(samples + w)), invert);
+    previous = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(samples + w - 1)), invert);
+    edges = _mm_andnot_si128(current, _mm_or_si128(_mm_slli_epi64(current, 1), _mm_srli_epi64(previous, 63)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(edges, _mm_setzero_si128())) != 0xffff) {
+      break;
+    }
+  }
+  return seatalk_decode_scan_words(decoder, samples, w, words, from);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t seatalk_decode_find_avx2(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t from) {
+  uint64_t words = (count + 63) / 64;
+  uint64_t w = from / 64;
+  __m256i invert = _mm256_set1_epi64x(decoder->invert_mask);
+  __m256i current;
+  __m256i previous;
+  __m256i edges;
+  uint64_t found;
+
+  found = seatalk_decode_scan_words(decoder, samples, w, w + 1 < words ? w + 1 : words, from);
+  if (found != UINT64_MAX) {
+    return found;
+  }
+  // eight words per pass; the line is idle or mid-character for long stretches
+  for (w++; w + 8 <= words; w += 8) {
+    current = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(samples + w)), invert);
+    previous = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(samples + w - 1)), invert);
+    edges = _mm256_andnot_si256(current, _mm256_or_si256(_mm256_slli_epi64(current, 1), _mm256_srli_epi64(previous, 63)));
+    current = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(samples + w + 4)), invert);
+    previous = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(samples + w + 3)), invert);
+    edges = _mm256_or_si256(edges, _mm256_andnot_si256(current, _mm256_or_si256(_mm256_slli_epi64(current, 1), _mm256_srli_epi64(previous, 63))));
+    if (!_mm256_testz_si256(edges, edges)) {
+      break;
+    }
+  }
+  return seatalk_decode_scan_words(decoder, samples, w, words, from);
+}
+#endif
+
+typedef uint64_t (*seatalk_decode_find_t)(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t from);
+
+// decode characters from samples [*position, count) using find to look for start bits, up to max of them.
+// *position is left where decoding should carry on: after the last character, or at the start bit of a character
+// that runs past the end of the samples, so a capture can be decoded a buffer at a time. Returns the number found
+static inline size_t seatalk_decode_characters_with(const struct seatalk_decoder *decoder, seatalk_decode_find_t find, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  uint64_t edge;
+  uint64_t from = *position;
+  size_t found = 0;
+  unsigned int character;
+  int bit;
+
+  while (found < max) {
+    edge = find(decoder, samples, count, from);
+    if (edge == UINT64_MAX) {
+      from = count;
+      break;
+    }
+    if (edge + decoder->sample_offsets[SEATALK_DECODE_SAMPLES - 1] >= count) {
+      // not all here yet
+      from = edge;
+      break;
+    }
+    character = 0;
+    for (bit = 0; bit < SEATALK_DECODE_DATA_BITS; bit++) {
+      character |= seatalk_decode_sample(decoder, samples, edge + decoder->sample_offsets[bit]) << bit;
+    }
+    characters[found].sample = edge;
+    characters[found].character = character;
+    characters[found].framing_error = !seatalk_decode_sample(decoder, samples, edge + decoder->sample_offsets[SEATALK_DECODE_DATA_BITS]);
+    memset(characters[found].reserved, 0, sizeof(characters[found].reserved));
+    found++;
+    from = edge + decoder->resume_offset;
+  }
+  *position = from < count ? from : count;
+  return found;
+}
+
+static inline size_t seatalk_decode_characters_reference(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  return seatalk_decode_characters_with(decoder, seatalk_decode_find_reference, samples, count, position, characters, max);
+}
+
+static inline size_t seatalk_decode_characters_scalar(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  return seatalk_decode_characters_with(decoder, seatalk_decode_find_scalar, samples, count, position, characters, max);
+}
+
+#ifdef SEATALK_DECODE_X86
+static inline size_t seatalk_decode_characters_sse2(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  return seatalk_decode_characters_with(decoder, seatalk_decode_find_sse2, samples, count, position, characters, max);
+}
+
+static inline size_t seatalk_decode_characters_avx2(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  return seatalk_decode_characters_with(decoder, seatalk_decode_find_avx2, samples, count, position, characters, max);
+}
+#endif
+
+// the fastest scan this processor supports
+static inline seatalk_decode_find_t seatalk_decode_best_find(void) {
+#ifdef SEATALK_DECODE_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return seatalk_decode_find_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return seatalk_decode_find_sse2;
+  }
+#endif
+  return seatalk_decode_find_scalar;
+}
+
+// safe to call from several threads at once
+static inline size_t seatalk_decode_characters(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t *position, struct seatalk_decoded_character *characters, size_t max) {
+  return seatalk_decode_characters_with(decoder, seatalk_decode_best_find(), samples, count, position, characters, max);
+}
+
+// Datagrams
+// Characters are assembled into datagrams as receive_character does: a character with the command bit starts a
+// new datagram (discarding any unfinished one as truncated) and the attribute byte gives the length.
+struct seatalk_decoded_datagram {
+  // sample number of the start bit edge of the command byte
+  uint64_t sample;
+  uint8_t length;
+  uint8_t bytes[SEATALK_MAX_DATAGRAM_LENGTH];
+  // characters in it whose stop bit was sampled at 0
+  uint8_t framing_errors;
+};
+
+struct seatalk_datagram_assembler {
+  struct seatalk_decoded_datagram datagram;
+  int expected_length;
+  // datagrams cut short by the next command byte
+  uint64_t truncated;
+};
+
+static inline void seatalk_datagram_assembler_init(struct seatalk_datagram_assembler *assembler) {
+  memset(assembler, 0, sizeof(*assembler));
+}
+
+// add the next character. Returns 1 and fills in *datagram when it completes one
+static inline int seatalk_decode_datagram(struct seatalk_datagram_assembler *assembler, const struct seatalk_decoded_character *character, struct seatalk_decoded_datagram *datagram) {
+  struct seatalk_decoded_datagram *current = &assembler->datagram;
+
+  if (character->character & SEATALK_DECODE_COMMAND_BIT) {
+    if (current->length) {
+      assembler->truncated++;
+    }
+    current->sample = character->sample;
+    current->length = 0;
+    current->framing_errors = 0;
+    assembler->expected_length = SEATALK_MAX_DATAGRAM_LENGTH;
+  } else if (!current->length) {
+    // no command byte before it; started listening mid-datagram
+    return 0;
+  }
+  current->bytes[current->length++] = character->character & 0xff;
+  current->framing_errors += character->framing_error;
+  if (current->length == 2) {
+    assembler->expected_length = 3 + (character->character & 0x0f);
+  }
+  if (current->length == assembler->expected_length) {
+    *datagram = *current;
+    current->length = 0;
+    return 1;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,245 @@
+// seatalk_decode_bench: throughput of the offline decoder (seatalk_decode.h) in samples per second
+//   seatalk_decode_bench [-r samples_per_second] [-s seconds] [-l load_percent] [-n runs] [-t] [-w capture]
+// Builds a synthetic capture of random datagrams with the given bus load (default 300 s at 1000000 samples per
+// second, 50% load, inverted like the RxD pin) and decodes it with every scan the processor supports. Each result
+// is checked against the characters that were encoded, and the best of runs (default 3) is reported against the
+// per-sample reference decoder. -t leaves the capture the right way up. -w also saves the capture as a raw
+// bitmap for seatalk_decode_file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "seatalk_decode.h"
+
+// characters decoded per call
+#define DECODE_BATCH 4096
+
+struct variant {
+  const char *name;
+  seatalk_decode_find_t find;
+};
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// clear samples [first, last)
+static void clear_samples(uint64_t *samples, uint64_t first, uint64_t last) {
+  for (; first < last && first % 64; first++) {
+    samples[first / 64] &= ~((uint64_t)1 << (first % 64));
+  }
+  for (; first + 64 <= last; first += 64) {
+    samples[first / 64] = 0;
+  }
+  for (; first < last; first++) {
+    samples[first / 64] &= ~((uint64_t)1 << (first % 64));
+  }
+}
+
+// first sample taken at or after time_ns
+static uint64_t sample_at(double time_ns, double samples_per_second) {
+  double sample = time_ns * samples_per_second / 1e9;
+  uint64_t whole = (uint64_t)sample;
+
+  return whole < sample ? whole + 1 : whole;
+}
+
+// random datagrams filling roughly load percent of the capture. Returns the characters encoded, in order
+static size_t build_capture(uint64_t *samples, uint64_t count, double samples_per_second, int load, struct seatalk_decoded_character **expected) {
+  double end_ns = count / samples_per_second * 1e9;
+  double character_ns = (double)SEATALK_BIT_INTERVAL_NS * SEATALK_CHARACTER_BITS;
+  double time_ns = 1e6;
+  size_t characters = 0;
+  size_t allocated = 0;
+  unsigned char datagram[SEATALK_MAX_DATAGRAM_LENGTH];
+  int length;
+  int i;
+  int bit;
+  unsigned int character;
+  double gap_ns;
+
+  memset(samples, 0xff, (count + 63) / 64 * sizeof(*samples));
+  *expected = NULL;
+  for (;;) {
+    datagram[0] = rand();
+    datagram[1] = rand();
+    length = 3 + (datagram[1] & 0x0f);
+    if (time_ns + (length + 1) * character_ns * 1.2 + 1e6 > end_ns) {
+      break;
+    }
+    for (i = 2; i < length; i++) {
+      datagram[i] = rand();
+    }
+    for (i = 0; i < length; i++) {
+      character = datagram[i] | (i ? 0 : SEATALK_DECODE_COMMAND_BIT);
+      if (characters == allocated) {
+        allocated = allocated ? allocated * 2 : 65536;
+        *expected = realloc(*expected, allocated * sizeof(**expected));
+      }
+      (*expected)[characters].sample = sample_at(time_ns, samples_per_second);
+      (*expected)[characters].character = character;
+      (*expected)[characters].framing_error = 0;
+      memset((*expected)[characters].reserved, 0, sizeof((*expected)[characters].reserved));
+      characters++;
+      // start bit then the data bits; the stop bit is idle
+      for (bit = 0; bit <= SEATALK_DECODE_DATA_BITS; bit++) {
+        if (bit == 0 || !((character >> (bit - 1)) & 1)) {
+          clear_samples(samples, sample_at(time_ns + (double)SEATALK_BIT_INTERVAL_NS * bit, samples_per_second), sample_at(time_ns + (double)SEATALK_BIT_INTERVAL_NS * (bit + 1), samples_per_second));
+        }
+      }
+      // talkers leave up to a couple of bits between characters
+      time_ns += character_ns + SEATALK_BIT_INTERVAL_NS * (rand() % 3) + rand() % 1000;
+    }
+    // idle gap giving the requested load on average
+    gap_ns = length * character_ns * (100 - load) / load;
+    time_ns += gap_ns * (0.5 + (double)rand() / RAND_MAX);
+  }
+  return characters;
+}
+
+// decode the whole capture, checking every character against what was encoded. Returns the time taken or 0 on a mismatch
+static uint64_t run(const struct seatalk_decoder *decoder, seatalk_decode_find_t find, const uint64_t *samples, uint64_t count, const struct seatalk_decoded_character *expected, size_t expected_count) {
+  static struct seatalk_decoded_character characters[DECODE_BATCH];
+  uint64_t position = 0;
+  uint64_t start = monotonic_ns();
+  uint64_t elapsed;
+  size_t decoded = 0;
+  size_t found;
+  size_t i;
+  int mismatch = 0;
+
+  do {
+    found = seatalk_decode_characters_with(decoder, find, samples, count, &position, characters, DECODE_BATCH);
+    for (i = 0; i < found && !mismatch; i++) {
+      if (decoded + i >= expected_count || characters[i].character != expected[decoded + i].character || characters[i].framing_error || characters[i].sample != expected[decoded + i].sample) {
+        fprintf(stderr, "character %zu: decoded %03x at %llu, expected %03x at %llu\n", decoded + i, characters[i].character, (unsigned long long)characters[i].sample, decoded + i < expected_count ? expected[decoded + i].character : 0, decoded + i < expected_count ? (unsigned long long)expected[decoded + i].sample : 0);
+        mismatch = 1;
+      }
+    }
+    decoded += found;
+  } while (found == DECODE_BATCH);
+  elapsed = monotonic_ns() - start;
+  if (!mismatch && decoded != expected_count) {
+    fprintf(stderr, "decoded %zu characters, expected %zu\n", decoded, expected_count);
+    mismatch = 1;
+  }
+  return mismatch ? 0 : elapsed;
+}
+
+int main(int argc, char **argv) {
+  int option;
+  double samples_per_second = 1e6;
+  double seconds = 300;
+  int load = 50;
+  int runs = 3;
+  int inverted = 1;
+  uint64_t count;
+  uint64_t *samples;
+  struct seatalk_decoder decoder;
+  struct seatalk_decoded_character *expected;
+  size_t expected_count;
+  uint64_t best;
+  uint64_t reference = 0;
+  uint64_t elapsed;
+  uint64_t w;
+  struct variant variants[4];
+  int variant_count = 0;
+  int i;
+  int r;
+  int failed = 0;
+  const char *path = NULL;
+  int file;
+
+  while ((option = getopt(argc, argv, "r:s:l:n:tw:")) != -1) {
+    switch (option) {
+    case 'r':
+      samples_per_second = atof(optarg);
+      break;
+    case 's':
+      seconds = atof(optarg);
+      break;
+    case 'l':
+      load = atoi(optarg);
+      break;
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 't':
+      inverted = 0;
+      break;
+    case 'w':
+      path = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r samples_per_second] [-s seconds] [-l load_percent] [-n runs] [-t] [-w capture]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (samples_per_second < 4 * 4800 || load < 1 || load > 99 || runs < 1) {
+    fprintf(stderr, "need at least 19200 samples per second, a load from 1 to 99%% and at least one run\n");
+    return 2;
+  }
+
+  count = (uint64_t)(samples_per_second * seconds);
+  samples = malloc((count + 63) / 64 * sizeof(*samples));
+  if (!samples) {
+    perror("malloc");
+    return 1;
+  }
+  expected_count = build_capture(samples, count, samples_per_second, load, &expected);
+  if (inverted) {
+    for (w = 0; w < (count + 63) / 64; w++) {
+      samples[w] = ~samples[w];
+    }
+  }
+  if (path) {
+    file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0 || write(file, samples, (count + 7) / 8) != (ssize_t)((count + 7) / 8) || close(file)) {
+      perror(path);
+      return 1;
+    }
+  }
+  seatalk_decoder_init(&decoder, samples_per_second, inverted);
+  printf("%llu samples (%.0f s at %.0f samples/s), %zu characters\n", (unsigned long long)count, seconds, samples_per_second, expected_count);
+
+  variants[variant_count++] = (struct variant){ "reference", seatalk_decode_find_reference };
+  variants[variant_count++] = (struct variant){ "scalar", seatalk_decode_find_scalar };
+#ifdef SEATALK_DECODE_X86
+  if (__builtin_cpu_supports("sse2")) {
+    variants[variant_count++] = (struct variant){ "sse2", seatalk_decode_find_sse2 };
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    variants[variant_count++] = (struct variant){ "avx2", seatalk_decode_find_avx2 };
+  }
+#endif
+  printf("%-10s %16s %10s\n", "scan", "samples/s", "speedup");
+  for (i = 0; i < variant_count; i++) {
+    best = UINT64_MAX;
+    for (r = 0; r < runs; r++) {
+      elapsed = run(&decoder, variants[i].find, samples, count, expected, expected_count);
+      if (!elapsed) {
+        break;
+      }
+      if (elapsed < best) {
+        best = elapsed;
+      }
+    }
+    if (r < runs) {
+      printf("%-10s %16s\n", variants[i].name, "WRONG");
+      failed = 1;
+      continue;
+    }
+    if (!i) {
+      reference = best;
+    }
+    printf("%-10s %16.0f %9.1fx\n", variants[i].name, count / (best / 1e9), (double)reference / best);
+  }
+  return failed;
+}
@@ -0,0 +1,372 @@
+// seatalk_decode_file: decode an oversampled capture file into datagrams using every core
+//   seatalk_decode_file [-r samples_per_second] [-t] [-j threads] [-q] [-c] capture
+// The capture is a raw packed bitmap of line samples as described in seatalk_decode.h (sample n is bit n % 8 of
+// byte n / 8), inverted like the RxD pin unless -t is given. Each datagram is printed as the time of its first start
+// bit in seconds from the start of the capture and its bytes in hex. -q prints only the totals. -c also decodes the
+// capture on one thread, checks the results are identical and reports both times.
+//
+// The capture is mapped and cut into chunks at points where decoding is certain to be in the same state as a fresh
+// decoder: inside an idle stretch (logical 1) longer than the time from a start bit to the point the receiver
+// accepts the next one, so every character before the cut is finished before it and none starts within it. The
+// chunks are decoded on a pool of threads that each work through their own run of chunks and steal from the far
+// end of another thread's run when theirs is empty. The characters are then joined in chunk order and assembled
+// into datagrams, giving exactly what a single pass over the whole file would.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "seatalk_decode.h"
+
+// aim for this many chunks per thread so that stealing can even out the load
+#define CHUNKS_PER_THREAD 8
+// but no smaller than this many samples
+#define MINIMUM_CHUNK_SAMPLES (1 << 22)
+// characters decoded per call
+#define DECODE_BATCH 4096
+
+struct characters {
+  struct seatalk_decoded_character *characters;
+  size_t count;
+  size_t allocated;
+};
+
+struct chunk {
+  uint64_t first_sample;
+  uint64_t end_sample;
+  struct characters result;
+};
+
+// the chunks a thread has still to decode, [head, tail). The owner takes from the head and thieves from the tail
+struct run {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+};
+
+struct pool {
+  const struct seatalk_decoder *decoder;
+  const uint64_t *samples;
+  struct chunk *chunks;
+  struct run *runs;
+  int threads;
+};
+
+struct worker {
+  struct pool *pool;
+  int index;
+};
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// decode samples [first, end) onto the end of result
+static void decode_range(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t first, uint64_t end, struct characters *result) {
+  size_t found;
+
+  do {
+    if (result->allocated - result->count < DECODE_BATCH) {
+      result->allocated = result->allocated * 2 + DECODE_BATCH;
+      result->characters = realloc(result->characters, result->allocated * sizeof(*result->characters));
+      if (!result->characters) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    found = seatalk_decode_characters(decoder, samples, end, &first, result->characters + result->count, DECODE_BATCH);
+    result->count += found;
+  } while (found == DECODE_BATCH);
+}
+
+// the first sample from word w on where a chunk may start, or UINT64_MAX if there is none before the end.
+// Needs enough whole idle words from a that [a, a + resume_offset] is idle; any character that started before a
+// has then finished and been accepted by a + resume_offset, and no start bit falls in between
+static uint64_t find_cut(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t w, uint64_t words) {
+  uint64_t idle = ~decoder->invert_mask;
+  uint64_t needed = decoder->resume_offset / 64 + 1;
+  uint64_t run = 0;
+
+  for (; w < words; w++) {
+    if (samples[w] != idle) {
+      run = 0;
+    } else if (++run == needed) {
+      return (w + 1 - needed) * 64 + decoder->resume_offset;
+    }
+  }
+  return UINT64_MAX;
+}
+
+// cut the capture into chunks of roughly chunk_samples each. Returns the number of chunks
+static size_t cut_chunks(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, uint64_t chunk_samples, struct chunk **chunks) {
+  uint64_t words = count / 64;
+  uint64_t first = 0;
+  uint64_t cut;
+  size_t chunk_count = 0;
+  size_t allocated = count / chunk_samples + 1;
+
+  *chunks = calloc(allocated, sizeof(**chunks));
+  if (!*chunks) {
+    perror("calloc");
+    exit(1);
+  }
+  // the last partial word may have bits beyond the end so it is never searched
+  while (first < count) {
+    cut = first + chunk_samples < count ? find_cut(decoder, samples, (first + chunk_samples) / 64, words) : UINT64_MAX;
+    if (cut >= count || chunk_count + 1 == allocated) {
+      cut = count;
+    }
+    (*chunks)[chunk_count].first_sample = first;
+    (*chunks)[chunk_count].end_sample = cut;
+    chunk_count++;
+    first = cut;
+  }
+  return chunk_count;
+}
+
+// the next chunk for thread index: its own first, then stolen from the end of another thread's run.
+// Returns -1 when every run is empty
+static long take_chunk(struct pool *pool, int index) {
+  struct run *run;
+  long chunk = -1;
+  int i;
+
+  for (i = 0; i < pool->threads && chunk < 0; i++) {
+    run = &pool->runs[(index + i) % pool->threads];
+    pthread_mutex_lock(&run->lock);
+    if (run->head < run->tail) {
+      chunk = i ? --run->tail : run->head++;
+    }
+    pthread_mutex_unlock(&run->lock);
+  }
+  return chunk;
+}
+
+static void *decode_chunks(void *argument) {
+  struct worker *worker = argument;
+  struct pool *pool = worker->pool;
+  struct chunk *chunk;
+  long index;
+
+  while ((index = take_chunk(pool, worker->index)) >= 0) {
+    chunk = &pool->chunks[index];
+    decode_range(pool->decoder, pool->samples, chunk->first_sample, chunk->end_sample, &chunk->result);
+  }
+  return NULL;
+}
+
+// decode every chunk on threads threads and join the results in order
+static void decode_parallel(const struct seatalk_decoder *decoder, const uint64_t *samples, uint64_t count, int threads, struct characters *result) {
+  struct pool pool;
+  struct worker *workers;
+  pthread_t *ids;
+  uint64_t chunk_samples = count / ((uint64_t)threads * CHUNKS_PER_THREAD) + 1;
+  size_t chunk_count;
+  size_t i;
+  int t;
+
+  if (chunk_samples < MINIMUM_CHUNK_SAMPLES) {
+    chunk_samples = MINIMUM_CHUNK_SAMPLES;
+  }
+  pool.decoder = decoder;
+  pool.samples = samples;
+  pool.threads = threads;
+  chunk_count = cut_chunks(decoder, samples, count, chunk_samples, &pool.chunks);
+  pool.runs = calloc(threads, sizeof(*pool.runs));
+  workers = calloc(threads, sizeof(*workers));
+  ids = calloc(threads, sizeof(*ids));
+  if (!pool.runs || !workers || !ids) {
+    perror("calloc");
+    exit(1);
+  }
+  // each thread starts with an even share of neighbouring chunks
+  for (t = 0; t < threads; t++) {
+    pthread_mutex_init(&pool.runs[t].lock, NULL);
+    pool.runs[t].head = chunk_count * t / threads;
+    pool.runs[t].tail = chunk_count * (t + 1) / threads;
+    workers[t].pool = &pool;
+    workers[t].index = t;
+  }
+  for (t = 1; t < threads; t++) {
+    if (pthread_create(&ids[t], NULL, decode_chunks, &workers[t])) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  decode_chunks(&workers[0]);
+  for (t = 1; t < threads; t++) {
+    pthread_join(ids[t], NULL);
+  }
+
+  memset(result, 0, sizeof(*result));
+  for (i = 0; i < chunk_count; i++) {
+    result->count += pool.chunks[i].result.count;
+  }
+  result->characters = malloc((result->count + 1) * sizeof(*result->characters));
+  if (!result->characters) {
+    perror("malloc");
+    exit(1);
+  }
+  result->count = 0;
+  for (i = 0; i < chunk_count; i++) {
+    memcpy(result->characters + result->count, pool.chunks[i].result.characters, pool.chunks[i].result.count * sizeof(*result->characters));
+    result->count += pool.chunks[i].result.count;
+    free(pool.chunks[i].result.characters);
+  }
+  for (t = 0; t < threads; t++) {
+    pthread_mutex_destroy(&pool.runs[t].lock);
+  }
+  free(pool.chunks);
+  free(pool.runs);
+  free(workers);
+  free(ids);
+}
+
+// assemble characters into datagrams. Returns the number of datagrams
+static size_t assemble(const struct characters *characters, struct seatalk_decoded_datagram **datagrams, uint64_t *truncated, uint64_t *framing_errors) {
+  struct seatalk_datagram_assembler assembler;
+  size_t count = 0;
+  size_t i;
+
+  // at least three characters each
+  *datagrams = malloc((characters->count / 3 + 1) * sizeof(**datagrams));
+  if (!*datagrams) {
+    perror("malloc");
+    exit(1);
+  }
+  seatalk_datagram_assembler_init(&assembler);
+  *framing_errors = 0;
+  for (i = 0; i < characters->count; i++) {
+    *framing_errors += characters->characters[i].framing_error;
+    count += seatalk_decode_datagram(&assembler, &characters->characters[i], &(*datagrams)[count]);
+  }
+  *truncated = assembler.truncated;
+  return count;
+}
+
+static int same_datagram(const struct seatalk_decoded_datagram *a, const struct seatalk_decoded_datagram *b) {
+  return a->sample == b->sample && a->length == b->length && a->framing_errors == b->framing_errors && !memcmp(a->bytes, b->bytes, a->length);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-r samples_per_second] [-t] [-j threads] [-q] [-c] capture\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int option;
+  double samples_per_second = 1e6;
+  int inverted = 1;
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int quiet = 0;
+  int check = 0;
+  int file;
+  struct stat file_status;
+  const uint64_t *samples;
+  uint64_t count;
+  struct seatalk_decoder decoder;
+  struct characters characters;
+  struct characters sequential;
+  struct seatalk_decoded_datagram *datagrams;
+  struct seatalk_decoded_datagram *sequential_datagrams;
+  size_t datagram_count;
+  size_t sequential_count;
+  uint64_t truncated;
+  uint64_t framing_errors;
+  uint64_t start;
+  uint64_t parallel_ns;
+  uint64_t sequential_ns;
+  size_t i;
+  int b;
+
+  while ((option = getopt(argc, argv, "r:tj:qc")) != -1) {
+    switch (option) {
+    case 'r':
+      samples_per_second = atof(optarg);
+      break;
+    case 't':
+      inverted = 0;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'c':
+      check = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || threads < 1 || samples_per_second < 4 * 4800) {
+    usage(argv[0]);
+  }
+
+  file = open(argv[optind], O_RDONLY);
+  if (file < 0 || fstat(file, &file_status)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (!file_status.st_size) {
+    fprintf(stderr, "%s: empty\n", argv[optind]);
+    return 1;
+  }
+  // the mapping is zero filled to a page boundary, so the last partial word can be read whole
+  samples = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  if (samples == MAP_FAILED) {
+    perror(argv[optind]);
+    return 1;
+  }
+  madvise((void *)samples, file_status.st_size, MADV_SEQUENTIAL);
+  count = (uint64_t)file_status.st_size * 8;
+  seatalk_decoder_init(&decoder, samples_per_second, inverted);
+
+  start = monotonic_ns();
+  decode_parallel(&decoder, samples, count, threads, &characters);
+  datagram_count = assemble(&characters, &datagrams, &truncated, &framing_errors);
+  parallel_ns = monotonic_ns() - start;
+
+  if (!quiet) {
+    for (i = 0; i < datagram_count; i++) {
+      printf("%.6f", datagrams[i].sample / samples_per_second);
+      for (b = 0; b < datagrams[i].length; b++) {
+        printf(" %02x", datagrams[i].bytes[b]);
+      }
+      printf("\n");
+    }
+  }
+  fprintf(stderr, "%zu datagrams, %zu characters, %llu framing errors, %llu truncated\n", datagram_count, characters.count, (unsigned long long)framing_errors, (unsigned long long)truncated);
+  fprintf(stderr, "%d threads: %.3f s, %.0f samples/s\n", threads, parallel_ns / 1e9, count / (parallel_ns / 1e9));
+
+  if (check) {
+    memset(&sequential, 0, sizeof(sequential));
+    start = monotonic_ns();
+    decode_range(&decoder, samples, 0, count, &sequential);
+    sequential_count = assemble(&sequential, &sequential_datagrams, &truncated, &framing_errors);
+    sequential_ns = monotonic_ns() - start;
+    fprintf(stderr, "1 thread: %.3f s, %.0f samples/s\n", sequential_ns / 1e9, count / (sequential_ns / 1e9));
+    if (sequential.count != characters.count || memcmp(sequential.characters, characters.characters, characters.count * sizeof(*characters.characters)) || sequential_count != datagram_count) {
+      fprintf(stderr, "parallel and sequential decodes differ\n");
+      return 1;
+    }
+    for (i = 0; i < datagram_count; i++) {
+      if (!same_datagram(&datagrams[i], &sequential_datagrams[i])) {
+        fprintf(stderr, "parallel and sequential decodes differ at datagram %zu\n", i);
+        return 1;
+      }
+    }
+    fprintf(stderr, "identical to the sequential decode\n");
+  }
+  return 0;
+}
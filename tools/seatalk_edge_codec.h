@@ -0,0 +1,153 @@
+#ifndef SEATALK_EDGE_CODEC_H
+#define SEATALK_EDGE_CODEC_H
+
+// Compact edge streams
+// Raw edges (struct seatalk_edge_ring) take 8 bytes each, but consecutive edges are nearly always a whole number of
+// bit intervals apart: only the first edge of a datagram falls off the previous character's bit clock. A compact
+// edge block stores its first edge raw, as a sync point a reader can start from, and each edge after that as
+// varints giving the number of bit intervals since the previous edge, how far it landed from there and whether it
+// broke the expected pattern of levels. A few microseconds of interrupt latency then costs two or three bytes an
+// edge, and one byte once the offsets are rounded to a resolution of a microsecond or so.
+//
+// Block layout:
+//   uint64_t first_edge      exactly as in the ring
+//   uint32_t resolution_ns   offsets are rounded to a multiple of this; 1 keeps every edge exact
+//   uint32_t count           edges in the block, including the first
+// then for each following edge:
+//   varint token = zigzag(offset / resolution_ns) << 4 | switched << 3 | intervals
+//   varint extended = (intervals << 1 | level_changed) when intervals in the token is 7
+// where the edge's time is the previous edge's time + intervals * SEATALK_BIT_INTERVAL_NS + offset. switched is
+// set for an edge in the other direction (SEATALK_EDGE_TX) to the one before, and its level is normally the
+// opposite of the last level seen in that direction; level_changed flips that. Rounding uses the times as decoded,
+// so errors never add up: with resolution_ns above 1 every time is within resolution_ns / 2 of the original.
+
+#include <stdint.h>
+#include <string.h>
+#include "../seatalk_hardware_gpio_uapi.h"
+
+#define SEATALK_EDGE_CODEC_HEADER_BYTES 16
+// longest a block of count edges can encode to
+#define SEATALK_EDGE_CODEC_MAX_BYTES(count) (SEATALK_EDGE_CODEC_HEADER_BYTES + (count) * 20)
+#define SEATALK_EDGE_CODEC_INTERVALS_EXTENDED 7
+
+static inline uint8_t *seatalk_edge_codec_put_varint(uint8_t *buffer, uint64_t value) {
+  while (value >= 0x80) {
+    *buffer++ = value | 0x80;
+    value >>= 7;
+  }
+  *buffer++ = value;
+  return buffer;
+}
+
+// NULL if the varint runs past end or is longer than 64 bits
+static inline const uint8_t *seatalk_edge_codec_get_varint(const uint8_t *buffer, const uint8_t *end, uint64_t *value) {
+  unsigned int shift = 0;
+
+  *value = 0;
+  while (buffer < end && shift < 64) {
+    *value |= (uint64_t)(*buffer & 0x7f) << shift;
+    if (!(*buffer++ & 0x80)) {
+      return buffer;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+static inline int64_t seatalk_edge_codec_divide_rounded(int64_t value, uint32_t divisor) {
+  return value >= 0 ? (value + divisor / 2) / divisor : -((-value + divisor / 2) / divisor);
+}
+
+// encode count (at least one) edges into buffer, which must hold SEATALK_EDGE_CODEC_MAX_BYTES(count). Returns the
+// length of the block
+static inline uint32_t seatalk_edge_encode(const uint64_t *edges, uint32_t count, uint32_t resolution_ns, uint8_t *buffer) {
+  uint8_t *next = buffer + SEATALK_EDGE_CODEC_HEADER_BYTES;
+  uint64_t previous_ns = seatalk_edge_time(edges[0]);
+  unsigned int direction = (edges[0] & SEATALK_EDGE_TX) != 0;
+  unsigned int last_level[2];
+  unsigned int edge_direction;
+  unsigned int level;
+  unsigned int level_changed;
+  int64_t difference;
+  uint64_t intervals;
+  int64_t offset;
+  uint32_t i;
+
+  memcpy(buffer, &edges[0], 8);
+  memcpy(buffer + 8, &resolution_ns, 4);
+  memcpy(buffer + 12, &count, 4);
+  last_level[0] = last_level[1] = edges[0] & SEATALK_EDGE_LEVEL;
+  for (i = 1; i < count; i++) {
+    edge_direction = (edges[i] & SEATALK_EDGE_TX) != 0;
+    level = edges[i] & SEATALK_EDGE_LEVEL;
+    level_changed = level != !last_level[edge_direction];
+    difference = seatalk_edge_time(edges[i]) - previous_ns;
+    intervals = difference > 0 ? (difference + SEATALK_BIT_INTERVAL_NS / 2) / SEATALK_BIT_INTERVAL_NS : 0;
+    offset = seatalk_edge_codec_divide_rounded(difference - (int64_t)(intervals * SEATALK_BIT_INTERVAL_NS), resolution_ns);
+    if (intervals < SEATALK_EDGE_CODEC_INTERVALS_EXTENDED && !level_changed) {
+      next = seatalk_edge_codec_put_varint(next, ((uint64_t)offset << 1 ^ (uint64_t)(offset >> 63)) << 4 | (edge_direction ^ direction) << 3 | intervals);
+    } else {
+      next = seatalk_edge_codec_put_varint(next, ((uint64_t)offset << 1 ^ (uint64_t)(offset >> 63)) << 4 | (edge_direction ^ direction) << 3 | SEATALK_EDGE_CODEC_INTERVALS_EXTENDED);
+      next = seatalk_edge_codec_put_varint(next, intervals << 1 | level_changed);
+    }
+    // carry on from the time the decoder will see
+    previous_ns += intervals * SEATALK_BIT_INTERVAL_NS + offset * (int64_t)resolution_ns;
+    direction = edge_direction;
+    last_level[direction] = level;
+  }
+  return next - buffer;
+}
+
+// decode a block into up to max edges. Returns the number of edges or -1 if the block is damaged or holds more
+static inline int64_t seatalk_edge_decode(const uint8_t *block, uint32_t length, uint64_t *edges, uint32_t max) {
+  const uint8_t *next = block + SEATALK_EDGE_CODEC_HEADER_BYTES;
+  const uint8_t *end = block + length;
+  uint64_t previous_ns;
+  unsigned int direction;
+  unsigned int last_level[2];
+  uint32_t resolution_ns;
+  uint32_t count;
+  uint64_t token;
+  uint64_t extended;
+  uint64_t intervals;
+  unsigned int level_changed;
+  int64_t offset;
+  uint32_t i;
+
+  if (length < SEATALK_EDGE_CODEC_HEADER_BYTES) {
+    return -1;
+  }
+  memcpy(&edges[0], block, 8);
+  memcpy(&resolution_ns, block + 8, 4);
+  memcpy(&count, block + 12, 4);
+  if (!count || count > max || !resolution_ns) {
+    return -1;
+  }
+  previous_ns = seatalk_edge_time(edges[0]);
+  direction = (edges[0] & SEATALK_EDGE_TX) != 0;
+  last_level[0] = last_level[1] = edges[0] & SEATALK_EDGE_LEVEL;
+  for (i = 1; i < count; i++) {
+    next = seatalk_edge_codec_get_varint(next, end, &token);
+    if (!next) {
+      return -1;
+    }
+    intervals = token & 7;
+    level_changed = 0;
+    if (intervals == SEATALK_EDGE_CODEC_INTERVALS_EXTENDED) {
+      next = seatalk_edge_codec_get_varint(next, end, &extended);
+      if (!next) {
+        return -1;
+      }
+      intervals = extended >> 1;
+      level_changed = extended & 1;
+    }
+    direction ^= (token >> 3) & 1;
+    offset = (int64_t)(token >> 5 ^ -(token >> 4 & 1));
+    previous_ns += intervals * SEATALK_BIT_INTERVAL_NS + offset * (int64_t)resolution_ns;
+    last_level[direction] ^= 1 ^ level_changed;
+    edges[i] = previous_ns << SEATALK_EDGE_FLAG_BITS | (direction ? SEATALK_EDGE_TX : 0) | last_level[direction];
+  }
+  return next == end ? (int64_t)count : -1;
+}
+
+#endif
@@ -0,0 +1,210 @@
+// seatalk_edge_codec_bench: size and speed of compact edge blocks (seatalk_edge_codec.h) against raw edges
+//   seatalk_edge_codec_bench [-s seconds] [-l load_percent] [-j jitter_ns] [-r resolution_ns] [-n runs]
+// Builds the edges a busy bus would leave in the edge capture ring (default 3600 s at 50% load, with each talker's
+// bit clock up to 0.2% out and up to jitter_ns, default 5000, of interrupt latency on every edge) and encodes them
+// in blocks of SEATALK_PCAPNG_EDGES_PER_BLOCK like seatalk_capture -z, exactly and at resolution_ns (default 1000).
+// Every block is decoded and checked. Reports the size against raw edges and the best of runs (default 3) encode
+// and decode rates, as edges per second and as multiples of the fastest the bus can produce them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "seatalk_pcapng.h"
+#include "seatalk_edge_codec.h"
+
+// one edge per bit
+#define BUS_EDGES_PER_SECOND (1000000000.0 / SEATALK_BIT_INTERVAL_NS)
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// the line level during each bit of a character; the start bit is 0, data bits least significant first, stop bit 1
+static int character_bit(unsigned int character, int bit) {
+  if (bit == 0) {
+    return 0;
+  }
+  if (bit > SEATALK_CHARACTER_BITS - 2) {
+    return 1;
+  }
+  return (character >> (bit - 1)) & 1;
+}
+
+// random datagrams filling roughly load percent of the line. Returns the number of edges
+static size_t build_edges(double seconds, int load, uint32_t jitter_ns, uint64_t **edges) {
+  double end_ns = seconds * 1e9;
+  double time_ns = 1e9;
+  double bit_ns;
+  size_t count = 0;
+  size_t allocated = 0;
+  int level = 1;
+  int length;
+  int i;
+  int bit;
+  unsigned int character;
+  uint64_t edge_ns;
+
+  *edges = NULL;
+  while (time_ns < end_ns) {
+    // each talker's clock is a little out
+    bit_ns = SEATALK_BIT_INTERVAL_NS * (1 + ((double)rand() / RAND_MAX - 0.5) * 0.004);
+    length = 3 + rand() % 16;
+    for (i = 0; i < length; i++) {
+      character = rand() & 0xff;
+      // the command bit; UARTs send the characters of a datagram back to back
+      character |= (i ? 0 : 0x100);
+      for (bit = 0; bit < SEATALK_CHARACTER_BITS; bit++) {
+        if (character_bit(character, bit) == level) {
+          continue;
+        }
+        level = !level;
+        if (count == allocated) {
+          allocated = allocated ? allocated * 2 : 1 << 20;
+          *edges = realloc(*edges, allocated * sizeof(**edges));
+        }
+        edge_ns = (uint64_t)(time_ns + bit * bit_ns) + (jitter_ns ? rand() % jitter_ns : 0);
+        (*edges)[count++] = edge_ns << SEATALK_EDGE_FLAG_BITS | level;
+      }
+      time_ns += SEATALK_CHARACTER_BITS * bit_ns;
+    }
+    time_ns += length * SEATALK_CHARACTER_BITS * bit_ns * (100 - load) / load * (0.5 + (double)rand() / RAND_MAX);
+  }
+  return count;
+}
+
+// encode every block then decode and check it. Returns the encoded size or 0 if a block decoded wrongly
+static uint64_t run(const uint64_t *edges, size_t count, uint32_t resolution_ns, uint8_t *buffer, uint64_t *decoded, uint64_t *encode_ns, uint64_t *decode_ns) {
+  uint64_t size = 0;
+  uint32_t lengths[64];
+  size_t first;
+  size_t block;
+  size_t blocks;
+  uint32_t block_count;
+  uint64_t start;
+  uint64_t error;
+  size_t i;
+
+  *encode_ns = 0;
+  *decode_ns = 0;
+  // in batches of blocks so the encoder and decoder are timed separately
+  for (first = 0; first < count; first += blocks * SEATALK_PCAPNG_EDGES_PER_BLOCK) {
+    blocks = (count - first + SEATALK_PCAPNG_EDGES_PER_BLOCK - 1) / SEATALK_PCAPNG_EDGES_PER_BLOCK;
+    if (blocks > 64) {
+      blocks = 64;
+    }
+    start = monotonic_ns();
+    for (block = 0; block < blocks; block++) {
+      block_count = count - first - block * SEATALK_PCAPNG_EDGES_PER_BLOCK;
+      if (block_count > SEATALK_PCAPNG_EDGES_PER_BLOCK) {
+        block_count = SEATALK_PCAPNG_EDGES_PER_BLOCK;
+      }
+      lengths[block] = seatalk_edge_encode(edges + first + block * SEATALK_PCAPNG_EDGES_PER_BLOCK, block_count, resolution_ns, buffer + block * SEATALK_EDGE_CODEC_MAX_BYTES(SEATALK_PCAPNG_EDGES_PER_BLOCK));
+      size += lengths[block];
+    }
+    *encode_ns += monotonic_ns() - start;
+    start = monotonic_ns();
+    for (block = 0; block < blocks; block++) {
+      if (seatalk_edge_decode(buffer + block * SEATALK_EDGE_CODEC_MAX_BYTES(SEATALK_PCAPNG_EDGES_PER_BLOCK), lengths[block], decoded + block * SEATALK_PCAPNG_EDGES_PER_BLOCK, SEATALK_PCAPNG_EDGES_PER_BLOCK) < 0) {
+        fprintf(stderr, "block at edge %zu does not decode\n", first + block * SEATALK_PCAPNG_EDGES_PER_BLOCK);
+        return 0;
+      }
+    }
+    *decode_ns += monotonic_ns() - start;
+    for (i = 0; i < blocks * SEATALK_PCAPNG_EDGES_PER_BLOCK && first + i < count; i++) {
+      error = seatalk_edge_time(decoded[i]) > seatalk_edge_time(edges[first + i]) ? seatalk_edge_time(decoded[i]) - seatalk_edge_time(edges[first + i]) : seatalk_edge_time(edges[first + i]) - seatalk_edge_time(decoded[i]);
+      if (error > resolution_ns / 2 || (decoded[i] ^ edges[first + i]) & ((1 << SEATALK_EDGE_FLAG_BITS) - 1)) {
+        fprintf(stderr, "edge %zu: decoded %llx, expected %llx\n", first + i, (unsigned long long)decoded[i], (unsigned long long)edges[first + i]);
+        return 0;
+      }
+    }
+  }
+  return size;
+}
+
+int main(int argc, char **argv) {
+  int option;
+  double seconds = 3600;
+  int load = 50;
+  uint32_t jitter_ns = 5000;
+  uint32_t resolutions[2] = { 1, 1000 };
+  int runs = 3;
+  uint64_t *edges;
+  uint64_t *decoded;
+  uint8_t *buffer;
+  size_t count;
+  uint64_t size;
+  uint64_t encode_ns;
+  uint64_t decode_ns;
+  uint64_t best_encode;
+  uint64_t best_decode;
+  int i;
+  int r;
+  int failed = 0;
+
+  while ((option = getopt(argc, argv, "s:l:j:r:n:")) != -1) {
+    switch (option) {
+    case 's':
+      seconds = atof(optarg);
+      break;
+    case 'l':
+      load = atoi(optarg);
+      break;
+    case 'j':
+      jitter_ns = atoi(optarg);
+      break;
+    case 'r':
+      resolutions[1] = atoi(optarg);
+      break;
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s seconds] [-l load_percent] [-j jitter_ns] [-r resolution_ns] [-n runs]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (load < 1 || load > 99 || runs < 1 || !resolutions[1]) {
+    fprintf(stderr, "need a load from 1 to 99%%, at least one run and a resolution of at least 1 ns\n");
+    return 2;
+  }
+
+  count = build_edges(seconds, load, jitter_ns, &edges);
+  decoded = malloc(64 * SEATALK_PCAPNG_EDGES_PER_BLOCK * sizeof(*decoded));
+  buffer = malloc(64 * SEATALK_EDGE_CODEC_MAX_BYTES(SEATALK_PCAPNG_EDGES_PER_BLOCK));
+  if (!count || !decoded || !buffer) {
+    fprintf(stderr, "no edges\n");
+    return 1;
+  }
+  printf("%zu edges (%.0f s at %d%% load, up to %u ns jitter), %zu bytes raw\n", count, seconds, load, jitter_ns, count * sizeof(*edges));
+  printf("%-14s %8s %8s %16s %16s\n", "resolution_ns", "bytes", "ratio", "encode edges/s", "decode edges/s");
+  for (i = 0; i < 2; i++) {
+    best_encode = UINT64_MAX;
+    best_decode = UINT64_MAX;
+    for (r = 0; r < runs; r++) {
+      size = run(edges, count, resolutions[i], buffer, decoded, &encode_ns, &decode_ns);
+      if (!size) {
+        break;
+      }
+      if (encode_ns < best_encode) {
+        best_encode = encode_ns;
+      }
+      if (decode_ns < best_decode) {
+        best_decode = decode_ns;
+      }
+    }
+    if (r < runs) {
+      printf("%-14u %8s\n", resolutions[i], "WRONG");
+      failed = 1;
+      continue;
+    }
+    printf("%-14u %8.2f %7.1fx %16.0f %16.0f\n", resolutions[i], (double)size / count, (double)count * sizeof(*edges) / size, count / (best_encode / 1e9), count / (best_decode / 1e9));
+  }
+  printf("the bus produces at most %.0f edges/s\n", BUS_EDGES_PER_SECOND);
+  return failed;
+}
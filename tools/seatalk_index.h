@@ -0,0 +1,236 @@
+#ifndef SEATALK_INDEX_H
+#define SEATALK_INDEX_H
+
+// SeaTalk capture indexes
+// seatalk_capture writes an index alongside each capture (capture.pcapng.idx) so that a query for a time range or
+// for datagrams with particular command bytes reads only the blocks it needs rather than the whole file.
+//
+// The index is a header followed by buckets, each covering the blocks written over bucket_ns of capture (or fewer
+// blocks when the bus is very busy). A bucket is appended as soon as it closes, so the index of a capture that is
+// still being written, or was cut short, covers all but the last bucket; everything in the capture from the last
+// bucket's end_offset on has to be scanned. A bucket gives the earliest and latest timestamps of its blocks (block
+// timestamps are not strictly in order: datagrams and edge blocks are written in batches), the range of the capture
+// file holding them and a bitmap of the command bytes of its datagrams. It is followed by a posting list for every
+// command byte in the bitmap, in ascending order: a uint32_t count and the offsets of that command's datagram blocks
+// relative to the bucket's offset, in file order.
+// All values are in this machine's byte order, as in the capture.
+
+#include <stdint.h>
+#include <string.h>
+#include "seatalk_pcapng.h"
+
+#define SEATALK_INDEX_MAGIC 0x58495453
+#define SEATALK_INDEX_VERSION 1
+#define SEATALK_INDEX_DEFAULT_BUCKET_NS 1000000000ull
+// datagrams in a bucket before it is closed early
+#define SEATALK_INDEX_BUCKET_DATAGRAMS 1024
+
+struct seatalk_index_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t bucket_ns;
+};
+
+struct seatalk_index_bucket {
+  // including the posting lists
+  uint32_t total_length;
+  uint32_t datagrams;
+  uint64_t first_ns;
+  uint64_t last_ns;
+  // the bucket's blocks are all in [offset, end_offset) of the capture
+  uint64_t offset;
+  uint64_t end_offset;
+  uint64_t commands[4];
+};
+
+// Writing
+// Call seatalk_index_add() for every block once it has been written to the capture, and seatalk_index_finish() at
+// the end
+struct seatalk_index_posting {
+  uint32_t offset;
+  uint8_t command;
+};
+
+struct seatalk_index_writer {
+  struct seatalk_pcapng_writer file;
+  uint64_t bucket_ns;
+  // the open bucket, if blocks is non-zero
+  struct seatalk_index_bucket bucket;
+  unsigned int blocks;
+  struct seatalk_index_posting postings[SEATALK_INDEX_BUCKET_DATAGRAMS];
+  // the closed bucket as written
+  uint32_t buffer[(sizeof(struct seatalk_index_bucket) + 256 * 4) / 4 + SEATALK_INDEX_BUCKET_DATAGRAMS];
+};
+
+// the header. Returns 0 or -errno
+static inline int seatalk_index_start(struct seatalk_index_writer *writer, int fd, uint64_t bucket_ns) {
+  struct seatalk_index_header header;
+  struct iovec iov;
+
+  writer->file.fd = fd;
+  writer->file.offset = 0;
+  writer->bucket_ns = bucket_ns;
+  writer->blocks = 0;
+  header.magic = SEATALK_INDEX_MAGIC;
+  header.version = SEATALK_INDEX_VERSION;
+  header.bucket_ns = bucket_ns;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  return seatalk_pcapng_writev(&writer->file, &iov, 1);
+}
+
+// write out the open bucket with its postings grouped by command. Returns 0 or -errno
+static inline int seatalk_index_close_bucket(struct seatalk_index_writer *writer) {
+  uint32_t counts[256];
+  uint32_t starts[256];
+  uint32_t *lists = writer->buffer + sizeof(writer->bucket) / 4;
+  uint32_t length = 0;
+  unsigned int command;
+  unsigned int i;
+  struct iovec iov;
+
+  if (!writer->blocks) {
+    return 0;
+  }
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < writer->bucket.datagrams; i++) {
+    counts[writer->postings[i].command]++;
+  }
+  // each list is its count followed by its offsets
+  for (command = 0; command < 256; command++) {
+    if (counts[command]) {
+      lists[length] = counts[command];
+      starts[command] = length + 1;
+      length += 1 + counts[command];
+    }
+  }
+  // a counting sort keeps each list in file order
+  for (i = 0; i < writer->bucket.datagrams; i++) {
+    lists[starts[writer->postings[i].command]++] = writer->postings[i].offset;
+  }
+  writer->bucket.total_length = sizeof(writer->bucket) + length * 4;
+  memcpy(writer->buffer, &writer->bucket, sizeof(writer->bucket));
+  writer->blocks = 0;
+  iov.iov_base = writer->buffer;
+  iov.iov_len = writer->bucket.total_length;
+  return seatalk_pcapng_writev(&writer->file, &iov, 1);
+}
+
+// a block written to the capture at [offset, end_offset). command is the command byte of a datagram block or -1 for
+// anything else. Returns 0 or -errno
+static inline int seatalk_index_add(struct seatalk_index_writer *writer, uint64_t offset, uint64_t end_offset, uint64_t timestamp_ns, int command) {
+  int result;
+
+  if (writer->blocks && (timestamp_ns >= writer->bucket.first_ns + writer->bucket_ns || (command >= 0 && writer->bucket.datagrams == SEATALK_INDEX_BUCKET_DATAGRAMS) || offset - writer->bucket.offset > UINT32_MAX)) {
+    result = seatalk_index_close_bucket(writer);
+    if (result) {
+      return result;
+    }
+  }
+  if (!writer->blocks) {
+    memset(&writer->bucket, 0, sizeof(writer->bucket));
+    writer->bucket.first_ns = timestamp_ns;
+    writer->bucket.last_ns = timestamp_ns;
+    writer->bucket.offset = offset;
+  }
+  writer->blocks++;
+  if (timestamp_ns < writer->bucket.first_ns) {
+    writer->bucket.first_ns = timestamp_ns;
+  }
+  if (timestamp_ns > writer->bucket.last_ns) {
+    writer->bucket.last_ns = timestamp_ns;
+  }
+  writer->bucket.end_offset = end_offset;
+  if (command >= 0) {
+    writer->bucket.commands[command / 64] |= (uint64_t)1 << (command % 64);
+    writer->postings[writer->bucket.datagrams].offset = offset - writer->bucket.offset;
+    writer->postings[writer->bucket.datagrams].command = command;
+    writer->bucket.datagrams++;
+  }
+  return 0;
+}
+
+static inline int seatalk_index_finish(struct seatalk_index_writer *writer) {
+  return seatalk_index_close_bucket(writer);
+}
+
+// Reading
+// Map the whole index and walk its buckets with seatalk_index_next()
+struct seatalk_index_reader {
+  const uint8_t *data;
+  uint64_t size;
+  // start of the next bucket
+  uint64_t offset;
+  uint64_t bucket_ns;
+};
+
+// Returns 0 or -1 if this is not an index
+static inline int seatalk_index_reader_init(struct seatalk_index_reader *reader, const void *data, uint64_t size) {
+  struct seatalk_index_header header;
+
+  memset(reader, 0, sizeof(*reader));
+  if (size < sizeof(header)) {
+    return -1;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != SEATALK_INDEX_MAGIC || header.version != SEATALK_INDEX_VERSION) {
+    return -1;
+  }
+  reader->data = data;
+  reader->size = size;
+  reader->offset = sizeof(header);
+  reader->bucket_ns = header.bucket_ns;
+  return 0;
+}
+
+// the next bucket, with *lists pointing at its posting lists. Returns 1, 0 at the end of the index (including a
+// bucket that was only partly written) or -1 if the index is damaged
+static inline int seatalk_index_next(struct seatalk_index_reader *reader, struct seatalk_index_bucket *bucket, const uint8_t **lists) {
+  if (reader->offset + sizeof(*bucket) > reader->size) {
+    return 0;
+  }
+  memcpy(bucket, reader->data + reader->offset, sizeof(*bucket));
+  if (bucket->total_length < sizeof(*bucket) || bucket->total_length % 4) {
+    return -1;
+  }
+  if (reader->offset + bucket->total_length > reader->size) {
+    return 0;
+  }
+  *lists = reader->data + reader->offset + sizeof(*bucket);
+  reader->offset += bucket->total_length;
+  return 1;
+}
+
+static inline int seatalk_index_has_command(const struct seatalk_index_bucket *bucket, unsigned int command) {
+  return (bucket->commands[command / 64] >> (command % 64)) & 1;
+}
+
+// the posting list of a command in a bucket: the number of datagrams in *count and a pointer to their uint32_t
+// offsets (read them with seatalk_pcapng_u32()). NULL if the bucket has none or is damaged
+static inline const uint8_t *seatalk_index_postings(const struct seatalk_index_bucket *bucket, const uint8_t *lists, unsigned int command, uint32_t *count) {
+  const uint8_t *end = lists + bucket->total_length - sizeof(*bucket);
+  unsigned int c;
+
+  if (!seatalk_index_has_command(bucket, command)) {
+    return NULL;
+  }
+  for (c = 0; c <= command; c++) {
+    if (!seatalk_index_has_command(bucket, c)) {
+      continue;
+    }
+    if (lists + 4 > end) {
+      return NULL;
+    }
+    *count = seatalk_pcapng_u32(lists);
+    if (lists + 4 + (uint64_t)*count * 4 > end) {
+      return NULL;
+    }
+    if (c == command) {
+      return lists + 4;
+    }
+    lists += 4 + *count * 4;
+  }
+  return NULL;
+}
+
+#endif
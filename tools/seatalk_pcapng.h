@@ -0,0 +1,323 @@
+#ifndef SEATALK_PCAPNG_H
+#define SEATALK_PCAPNG_H
+
+// SeaTalk capture files
+// Captures are ordinary pcapng files (https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng) so they can be
+// indexed, filtered and merged with standard tools. A file holds one section with three interfaces, all with
+// nanosecond timestamps:
+//   interface 0, LINKTYPE_USER0: one Enhanced Packet Block per datagram. The packet is the datagram starting with
+//     its command byte and the timestamp is the start bit edge of the command byte (start_ns).
+//   interface 1, LINKTYPE_USER1: blocks of raw edges from the driver's edge capture ring. Each packet holds up to
+//     SEATALK_PCAPNG_EDGES_PER_BLOCK u64 edges, in the byte order of the section, exactly as in struct
+//     seatalk_edge_ring (CLOCK_MONOTONIC times). The block timestamp is the first edge's time and epb_dropcount
+//     gives the number of edges lost to ring overruns just before the block.
+//   interface 2, LINKTYPE_USER2: the same blocks of edges in the compact form described in seatalk_edge_codec.h.
+//     Timestamps and epb_dropcount are as for interface 1.
+// Block timestamps are CLOCK_REALTIME; the monotonic to realtime offset in force when a block was written is its
+// timestamp less the monotonic time of its first edge (or start_ns).
+// Wireshark shows the packets as raw data unless told how to dissect the user link types.
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define SEATALK_PCAPNG_SECTION_HEADER 0x0a0d0d0a
+#define SEATALK_PCAPNG_INTERFACE_DESCRIPTION 1
+#define SEATALK_PCAPNG_ENHANCED_PACKET 6
+#define SEATALK_PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+#define SEATALK_PCAPNG_LINKTYPE_DATAGRAMS 147
+#define SEATALK_PCAPNG_LINKTYPE_EDGES 148
+#define SEATALK_PCAPNG_LINKTYPE_COMPACT_EDGES 149
+
+#define SEATALK_PCAPNG_INTERFACE_DATAGRAMS 0
+#define SEATALK_PCAPNG_INTERFACE_EDGES 1
+#define SEATALK_PCAPNG_INTERFACE_COMPACT_EDGES 2
+
+#define SEATALK_PCAPNG_EDGES_PER_BLOCK 4096
+
+// option codes
+#define SEATALK_PCAPNG_OPT_END 0
+#define SEATALK_PCAPNG_IF_NAME 2
+#define SEATALK_PCAPNG_IF_TSRESOL 9
+#define SEATALK_PCAPNG_EPB_DROPCOUNT 4
+
+// fixed part of an Enhanced Packet Block. The packet data, padding to 4 bytes, options and the repeated total
+// length follow
+struct seatalk_pcapng_packet_header {
+  uint32_t type;
+  uint32_t total_length;
+  uint32_t interface;
+  uint32_t timestamp_high;
+  uint32_t timestamp_low;
+  uint32_t captured_length;
+  uint32_t original_length;
+};
+
+// everything after the packet data of an Enhanced Packet Block: padding, an optional epb_dropcount and the
+// repeated total length
+struct seatalk_pcapng_packet_trailer {
+  uint8_t bytes[3 + 4 + 8 + 4 + 4];
+  unsigned int length;
+};
+
+// writes go straight to the file descriptor; offset is where the next block will start
+struct seatalk_pcapng_writer {
+  int fd;
+  uint64_t offset;
+};
+
+static inline uint32_t seatalk_pcapng_padded(uint32_t length) {
+  return (length + 3) & ~3u;
+}
+
+// write all of an iovec array, carrying on after short writes. Returns 0 or -errno
+static inline int seatalk_pcapng_writev(struct seatalk_pcapng_writer *writer, struct iovec *iov, int count) {
+  ssize_t written;
+
+  while (count) {
+    written = writev(writer->fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    writer->offset += written;
+    while (count && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+static inline uint32_t seatalk_pcapng_put_option(uint8_t *buffer, uint16_t code, const void *value, uint16_t length) {
+  memcpy(buffer, &code, 2);
+  memcpy(buffer + 2, &length, 2);
+  if (length) {
+    memcpy(buffer + 4, value, length);
+  }
+  memset(buffer + 4 + length, 0, seatalk_pcapng_padded(length) - length);
+  return 4 + seatalk_pcapng_padded(length);
+}
+
+static inline uint32_t seatalk_pcapng_put_interface(uint8_t *buffer, uint16_t link_type, const char *name) {
+  uint32_t length = 16;
+  uint32_t u32;
+  uint8_t resolution = 9;
+
+  u32 = SEATALK_PCAPNG_INTERFACE_DESCRIPTION;
+  memcpy(buffer, &u32, 4);
+  memcpy(buffer + 8, &link_type, 2);
+  memset(buffer + 10, 0, 6);
+  length += seatalk_pcapng_put_option(buffer + length, SEATALK_PCAPNG_IF_NAME, name, strlen(name));
+  length += seatalk_pcapng_put_option(buffer + length, SEATALK_PCAPNG_IF_TSRESOL, &resolution, 1);
+  length += seatalk_pcapng_put_option(buffer + length, SEATALK_PCAPNG_OPT_END, NULL, 0);
+  length += 4;
+  memcpy(buffer + 4, &length, 4);
+  memcpy(buffer + length - 4, &length, 4);
+  return length;
+}
+
+// section header and every interface description. Returns 0 or -errno
+static inline int seatalk_pcapng_start(struct seatalk_pcapng_writer *writer) {
+  uint8_t buffer[512];
+  uint32_t length = 28;
+  uint32_t u32;
+  uint16_t u16;
+  int64_t section_length = -1;
+  struct iovec iov;
+
+  u32 = SEATALK_PCAPNG_SECTION_HEADER;
+  memcpy(buffer, &u32, 4);
+  memcpy(buffer + 4, &length, 4);
+  u32 = SEATALK_PCAPNG_BYTE_ORDER_MAGIC;
+  memcpy(buffer + 8, &u32, 4);
+  u16 = 1;
+  memcpy(buffer + 12, &u16, 2);
+  u16 = 0;
+  memcpy(buffer + 14, &u16, 2);
+  memcpy(buffer + 16, &section_length, 8);
+  memcpy(buffer + 24, &length, 4);
+  length += seatalk_pcapng_put_interface(buffer + length, SEATALK_PCAPNG_LINKTYPE_DATAGRAMS, "seatalk datagrams");
+  length += seatalk_pcapng_put_interface(buffer + length, SEATALK_PCAPNG_LINKTYPE_EDGES, "seatalk edges");
+  length += seatalk_pcapng_put_interface(buffer + length, SEATALK_PCAPNG_LINKTYPE_COMPACT_EDGES, "seatalk compact edges");
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  return seatalk_pcapng_writev(writer, &iov, 1);
+}
+
+// fill in the header and trailer of an Enhanced Packet Block carrying length bytes of packet data.
+// A non-zero drop_count is written as epb_dropcount. Returns the total length of the block
+static inline uint32_t seatalk_pcapng_packet(struct seatalk_pcapng_packet_header *header, struct seatalk_pcapng_packet_trailer *trailer, uint32_t interface, uint64_t timestamp_ns, uint32_t length, uint64_t drop_count) {
+  uint32_t padding = seatalk_pcapng_padded(length) - length;
+  uint32_t total_length = sizeof(*header) + seatalk_pcapng_padded(length) + 4;
+
+  memset(trailer->bytes, 0, padding);
+  trailer->length = padding;
+  if (drop_count) {
+    total_length += 12 + 4;
+    trailer->length += seatalk_pcapng_put_option(trailer->bytes + trailer->length, SEATALK_PCAPNG_EPB_DROPCOUNT, &drop_count, 8);
+    trailer->length += seatalk_pcapng_put_option(trailer->bytes + trailer->length, SEATALK_PCAPNG_OPT_END, NULL, 0);
+  }
+  memcpy(trailer->bytes + trailer->length, &total_length, 4);
+  trailer->length += 4;
+
+  header->type = SEATALK_PCAPNG_ENHANCED_PACKET;
+  header->total_length = total_length;
+  header->interface = interface;
+  header->timestamp_high = timestamp_ns >> 32;
+  header->timestamp_low = timestamp_ns;
+  header->captured_length = length;
+  header->original_length = length;
+  return total_length;
+}
+
+// Reading
+// Map the whole file and walk it with seatalk_pcapng_next(). Copes with files from other writers as long as they
+// are in this machine's byte order (merged files can have more sections and interfaces, in any order)
+#define SEATALK_PCAPNG_MAX_INTERFACES 16
+
+struct seatalk_pcapng_reader {
+  const uint8_t *data;
+  uint64_t size;
+  // start of the next block
+  uint64_t offset;
+  unsigned int interfaces;
+  uint16_t link_types[SEATALK_PCAPNG_MAX_INTERFACES];
+  // if_tsresol of each interface
+  uint8_t resolutions[SEATALK_PCAPNG_MAX_INTERFACES];
+};
+
+struct seatalk_pcapng_record {
+  // file offset of the block
+  uint64_t offset;
+  uint16_t link_type;
+  uint64_t timestamp_ns;
+  uint32_t length;
+  const uint8_t *data;
+  // epb_dropcount, zero if absent
+  uint64_t drop_count;
+};
+
+static inline void seatalk_pcapng_reader_init(struct seatalk_pcapng_reader *reader, const void *data, uint64_t size) {
+  memset(reader, 0, sizeof(*reader));
+  reader->data = data;
+  reader->size = size;
+}
+
+static inline uint32_t seatalk_pcapng_u32(const uint8_t *bytes) {
+  uint32_t value;
+
+  memcpy(&value, bytes, 4);
+  return value;
+}
+
+static inline uint64_t seatalk_pcapng_timestamp_ns(uint64_t timestamp, uint8_t resolution) {
+  uint64_t scale = 1;
+  int exponent = resolution & 0x7f;
+
+  if (resolution & 0x80) {
+    // power of two fractions of a second
+    return (unsigned __int128)timestamp * 1000000000 >> exponent;
+  }
+  while (exponent < 9) {
+    scale *= 10;
+    exponent++;
+  }
+  while (exponent > 9) {
+    timestamp /= 10;
+    exponent--;
+  }
+  return timestamp * scale;
+}
+
+// value of the first option with code wanted in the options running up to end, with its length in *length. NULL if absent
+static inline const uint8_t *seatalk_pcapng_find_option(const uint8_t *options, const uint8_t *end, uint16_t wanted, uint16_t *length) {
+  uint16_t code;
+
+  while (options + 4 <= end) {
+    memcpy(&code, options, 2);
+    memcpy(length, options + 2, 2);
+    if (code == SEATALK_PCAPNG_OPT_END || options + 4 + *length > end) {
+      break;
+    }
+    if (code == wanted) {
+      return options + 4;
+    }
+    options += 4 + seatalk_pcapng_padded(*length);
+  }
+  return NULL;
+}
+
+// the next packet in the file. Returns 1, 0 at the end of the file or -1 if the file is damaged or in the other
+// byte order
+static inline int seatalk_pcapng_next(struct seatalk_pcapng_reader *reader, struct seatalk_pcapng_record *record) {
+  const uint8_t *block;
+  const uint8_t *end;
+  const uint8_t *option;
+  uint32_t type;
+  uint32_t length;
+  uint32_t interface;
+  uint16_t option_length;
+
+  while (reader->offset + 12 <= reader->size) {
+    block = reader->data + reader->offset;
+    type = seatalk_pcapng_u32(block);
+    length = seatalk_pcapng_u32(block + 4);
+    if (length < 12 || length % 4 || reader->offset + length > reader->size) {
+      return -1;
+    }
+    end = block + length - 4;
+    record->offset = reader->offset;
+    reader->offset += length;
+    switch (type) {
+    case SEATALK_PCAPNG_SECTION_HEADER:
+      if (length < 28 || seatalk_pcapng_u32(block + 8) != SEATALK_PCAPNG_BYTE_ORDER_MAGIC) {
+        return -1;
+      }
+      // interface numbers start again in every section
+      reader->interfaces = 0;
+      break;
+    case SEATALK_PCAPNG_INTERFACE_DESCRIPTION:
+      if (length < 20 || reader->interfaces == SEATALK_PCAPNG_MAX_INTERFACES) {
+        return -1;
+      }
+      memcpy(&reader->link_types[reader->interfaces], block + 8, 2);
+      option = seatalk_pcapng_find_option(block + 16, end, SEATALK_PCAPNG_IF_TSRESOL, &option_length);
+      // microseconds unless stated
+      reader->resolutions[reader->interfaces] = option && option_length == 1 ? *option : 6;
+      reader->interfaces++;
+      break;
+    case SEATALK_PCAPNG_ENHANCED_PACKET:
+      interface = seatalk_pcapng_u32(block + 8);
+      record->length = seatalk_pcapng_u32(block + 20);
+      if (length < 32 || interface >= reader->interfaces || block + 28 + seatalk_pcapng_padded(record->length) > end) {
+        return -1;
+      }
+      record->link_type = reader->link_types[interface];
+      record->timestamp_ns = seatalk_pcapng_timestamp_ns((uint64_t)seatalk_pcapng_u32(block + 12) << 32 | seatalk_pcapng_u32(block + 16), reader->resolutions[interface]);
+      record->data = block + 28;
+      record->drop_count = 0;
+      option = seatalk_pcapng_find_option(block + 28 + seatalk_pcapng_padded(record->length), end, SEATALK_PCAPNG_EPB_DROPCOUNT, &option_length);
+      if (option && option_length == 8) {
+        memcpy(&record->drop_count, option, 8);
+      }
+      return 1;
+    default:
+      // statistics, name resolution and anything else
+      break;
+    }
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,291 @@
+// seatalk_query: print the datagrams in a capture file from a time range and with given command bytes
+//   seatalk_query [-s start] [-e end] [-c command]... [-i index] [-v] capture.pcapng
+// start and end are local times as "YYYY-MM-DD[ HH:MM[:SS[.fraction]]]" or seconds since the epoch; either may be
+// left out. Each -c adds a command byte in hex; with none every datagram is printed. Each datagram is printed as
+// its local time and its bytes in hex, in file order. -v reports how much of the capture had to be read.
+//
+// The index written by seatalk_capture (capture.pcapng.idx unless -i is given, see seatalk_index.h) is used to skip
+// every bucket outside the time range and, with -c, to go straight to the matching datagrams through the posting
+// lists. Only the part of the capture after the last complete bucket is scanned, or all of it if there is no index.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "seatalk_pcapng.h"
+#include "seatalk_index.h"
+
+struct query {
+  uint64_t start_ns;
+  uint64_t end_ns;
+  // command bytes wanted, all if any_command
+  uint64_t commands[4];
+  int any_command;
+  uint64_t matched;
+  uint64_t blocks_read;
+  uint64_t bytes_read;
+};
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s start] [-e end] [-c command]... [-i index] [-v] capture.pcapng\n", name);
+  exit(2);
+}
+
+// a local time or seconds since the epoch in ns. Returns 0 or -1 if it can't be read
+static int parse_time(const char *text, uint64_t *time_ns) {
+  struct tm local;
+  double seconds = 0;
+  double epoch;
+  char *end;
+  time_t whole;
+
+  memset(&local, 0, sizeof(local));
+  if (sscanf(text, "%d-%d-%d %d:%d:%lf", &local.tm_year, &local.tm_mon, &local.tm_mday, &local.tm_hour, &local.tm_min, &seconds) >= 3) {
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    whole = mktime(&local);
+    if (whole == (time_t)-1 || seconds < 0 || seconds >= 61) {
+      return -1;
+    }
+    *time_ns = (uint64_t)whole * 1000000000 + (uint64_t)(seconds * 1e9);
+    return 0;
+  }
+  epoch = strtod(text, &end);
+  if (end == text || *end || epoch < 0) {
+    return -1;
+  }
+  *time_ns = (uint64_t)(epoch * 1e9);
+  return 0;
+}
+
+static void print_datagram(const struct seatalk_pcapng_record *record) {
+  time_t seconds = record->timestamp_ns / 1000000000;
+  struct tm local;
+  char text[32];
+  uint32_t i;
+
+  localtime_r(&seconds, &local);
+  strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+  printf("%s.%06llu", text, (unsigned long long)(record->timestamp_ns % 1000000000 / 1000));
+  for (i = 0; i < record->length; i++) {
+    printf(" %02x", record->data[i]);
+  }
+  printf("\n");
+}
+
+// read the block at offset and print it if it is a datagram the query wants. Returns the reader's result
+static int visit(struct seatalk_pcapng_reader *reader, uint64_t offset, struct query *query) {
+  struct seatalk_pcapng_record record;
+  int result;
+
+  reader->offset = offset;
+  result = seatalk_pcapng_next(reader, &record);
+  if (result <= 0) {
+    return result;
+  }
+  query->blocks_read++;
+  query->bytes_read += reader->offset - offset;
+  if (record.link_type == SEATALK_PCAPNG_LINKTYPE_DATAGRAMS && record.length && record.timestamp_ns >= query->start_ns && record.timestamp_ns <= query->end_ns && (query->any_command || (query->commands[record.data[0] / 64] >> (record.data[0] % 64)) & 1)) {
+    print_datagram(&record);
+    query->matched++;
+  }
+  return 1;
+}
+
+// every block from offset up to end_offset. Returns 0 or -1 if the capture is damaged
+static int scan(struct seatalk_pcapng_reader *reader, uint64_t offset, uint64_t end_offset, struct query *query) {
+  int result = 1;
+
+  while (offset < end_offset && (result = visit(reader, offset, query)) > 0) {
+    offset = reader->offset;
+  }
+  return result < 0 ? -1 : 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+// the wanted datagrams of one bucket, through its posting lists. Returns 0 or -1 if the capture or index is damaged
+static int visit_postings(struct seatalk_pcapng_reader *reader, const struct seatalk_index_bucket *bucket, const uint8_t *lists, struct query *query) {
+  static uint32_t offsets[SEATALK_INDEX_BUCKET_DATAGRAMS];
+  const uint8_t *postings;
+  uint32_t count;
+  uint32_t found = 0;
+  uint32_t i;
+  unsigned int command;
+
+  for (command = 0; command < 256; command++) {
+    if (!((query->commands[command / 64] >> (command % 64)) & 1) || !seatalk_index_has_command(bucket, command)) {
+      continue;
+    }
+    postings = seatalk_index_postings(bucket, lists, command, &count);
+    if (!postings || count > SEATALK_INDEX_BUCKET_DATAGRAMS - found) {
+      return -1;
+    }
+    for (i = 0; i < count; i++) {
+      offsets[found++] = seatalk_pcapng_u32(postings + i * 4);
+    }
+  }
+  // back into file order across commands
+  qsort(offsets, found, sizeof(offsets[0]), compare_u32);
+  for (i = 0; i < found; i++) {
+    if (visit(reader, bucket->offset + offsets[i], query) <= 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// map a whole file read-only. NULL if it can't be opened
+static const void *map_file(const char *path, uint64_t *size) {
+  int file;
+  struct stat file_status;
+  void *data;
+
+  file = open(path, O_RDONLY);
+  if (file < 0) {
+    return NULL;
+  }
+  if (fstat(file, &file_status) || !file_status.st_size) {
+    close(file);
+    return NULL;
+  }
+  data = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  *size = file_status.st_size;
+  return data;
+}
+
+int main(int argc, char **argv) {
+  int option;
+  struct query query;
+  const char *index_path = NULL;
+  char *default_index_path = NULL;
+  int verbose = 0;
+  unsigned long command;
+  char *end;
+  const void *capture;
+  uint64_t capture_size;
+  const void *index = NULL;
+  uint64_t index_size = 0;
+  struct seatalk_pcapng_reader reader;
+  struct seatalk_pcapng_record record;
+  struct seatalk_index_reader index_reader;
+  struct seatalk_index_bucket bucket;
+  const uint8_t *lists;
+  uint64_t indexed_end = 0;
+  uint64_t buckets = 0;
+  uint64_t buckets_visited = 0;
+  int result = 0;
+
+  memset(&query, 0, sizeof(query));
+  query.end_ns = UINT64_MAX;
+  query.any_command = 1;
+  while ((option = getopt(argc, argv, "s:e:c:i:v")) != -1) {
+    switch (option) {
+    case 's':
+      if (parse_time(optarg, &query.start_ns)) {
+        usage(argv[0]);
+      }
+      break;
+    case 'e':
+      if (parse_time(optarg, &query.end_ns)) {
+        usage(argv[0]);
+      }
+      break;
+    case 'c':
+      command = strtoul(optarg, &end, 16);
+      if (end == optarg || *end || command > 0xff) {
+        usage(argv[0]);
+      }
+      query.commands[command / 64] |= (uint64_t)1 << (command % 64);
+      query.any_command = 0;
+      break;
+    case 'i':
+      index_path = optarg;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  capture = map_file(argv[optind], &capture_size);
+  if (!capture) {
+    perror(argv[optind]);
+    return 1;
+  }
+  // the section header and interface descriptions, which every seek relies on
+  seatalk_pcapng_reader_init(&reader, capture, capture_size);
+  if (seatalk_pcapng_next(&reader, &record) < 0) {
+    fprintf(stderr, "%s: not a readable SeaTalk capture\n", argv[optind]);
+    return 1;
+  }
+
+  if (!index_path) {
+    default_index_path = malloc(strlen(argv[optind]) + 5);
+    if (!default_index_path) {
+      perror("malloc");
+      return 1;
+    }
+    sprintf(default_index_path, "%s.idx", argv[optind]);
+    index_path = default_index_path;
+  }
+  index = map_file(index_path, &index_size);
+  if (!index || seatalk_index_reader_init(&index_reader, index, index_size)) {
+    fprintf(stderr, "%s: no usable index, scanning the whole capture\n", index_path);
+    index = NULL;
+  }
+  while (index && (result = seatalk_index_next(&index_reader, &bucket, &lists)) > 0) {
+    buckets++;
+    if (bucket.end_offset > capture_size) {
+      // the capture was truncated after the index was written
+      break;
+    }
+    indexed_end = bucket.end_offset;
+    if (bucket.last_ns < query.start_ns || bucket.first_ns > query.end_ns) {
+      continue;
+    }
+    buckets_visited++;
+    if (query.any_command) {
+      result = scan(&reader, bucket.offset, bucket.end_offset, &query);
+    } else {
+      result = visit_postings(&reader, &bucket, lists, &query);
+    }
+    if (result) {
+      break;
+    }
+  }
+  if (result < 0) {
+    fprintf(stderr, "%s: damaged, scanning the rest of the capture\n", index_path);
+  }
+  // whatever the index doesn't cover
+  if (scan(&reader, indexed_end, capture_size, &query)) {
+    fprintf(stderr, "%s: damaged\n", argv[optind]);
+    return 1;
+  }
+
+  if (verbose) {
+    fprintf(stderr, "%llu datagrams; read %llu blocks, %llu of %llu bytes of the capture, from %llu of %llu index buckets\n", (unsigned long long)query.matched, (unsigned long long)query.blocks_read, (unsigned long long)query.bytes_read, (unsigned long long)capture_size, (unsigned long long)buckets_visited, (unsigned long long)buckets);
+  }
+  free(default_index_path);
+  return 0;
+}
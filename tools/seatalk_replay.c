@@ -0,0 +1,238 @@
+// seatalk_replay: send the datagrams in a capture file (see seatalk_pcapng.h) with their original timing
+//   seatalk_replay [-c class] [-l lead_ms] capture.pcapng
+// Every datagram is submitted with a target time (struct seatalk_tx_request target_ns) the same distance after
+// the first as it was in the capture, so the driver starts each one on the bit clock rather than when a sleeping
+// process happens to wake. The first is sent lead_ms (default 100) after the program starts. Datagrams go in
+// transmit class class (default data; see enum seatalk_tx_class).
+// At the end the schedule error, how long after its target each datagram's first start bit actually went, is
+// reported along with any datagrams that could not be sent. Use simulate_line=1 to replay onto the simulated bus.
+// Submitting needs CAP_NET_ADMIN.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../seatalk_hardware_gpio_uapi.h"
+#include "seatalk_pcapng.h"
+
+// timed datagrams kept waiting in the driver at once; half its limit so other programs can still use it
+#define IN_FLIGHT (SEATALK_TX_TIMED_MAX / 2)
+
+struct datagram {
+  uint64_t target_ns;
+  const uint8_t *bytes;
+  uint8_t length;
+};
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+// every datagram in the capture, with its offset from the first in target_ns. Returns the number found or -1
+static long load_datagrams(const void *file, uint64_t size, struct datagram **datagrams) {
+  struct seatalk_pcapng_reader reader;
+  struct seatalk_pcapng_record record;
+  long count = 0;
+  long allocated = 0;
+  uint64_t first_ns = 0;
+  int result;
+
+  *datagrams = NULL;
+  seatalk_pcapng_reader_init(&reader, file, size);
+  while ((result = seatalk_pcapng_next(&reader, &record)) > 0) {
+    if (record.link_type != SEATALK_PCAPNG_LINKTYPE_DATAGRAMS || record.length < 3 || record.length > SEATALK_MAX_DATAGRAM_LENGTH) {
+      continue;
+    }
+    if (count == allocated) {
+      allocated = allocated ? allocated * 2 : 1024;
+      *datagrams = realloc(*datagrams, allocated * sizeof(**datagrams));
+      if (!*datagrams) {
+        return -1;
+      }
+    }
+    if (!count) {
+      first_ns = record.timestamp_ns;
+    }
+    // a file merged from several captures may step back; send those straight after the one before
+    (*datagrams)[count].target_ns = record.timestamp_ns > first_ns ? record.timestamp_ns - first_ns : 0;
+    if (count && (*datagrams)[count].target_ns < (*datagrams)[count - 1].target_ns) {
+      (*datagrams)[count].target_ns = (*datagrams)[count - 1].target_ns;
+    }
+    (*datagrams)[count].bytes = record.data;
+    (*datagrams)[count].length = record.length;
+    count++;
+  }
+  return result < 0 ? -1 : count;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-c class] [-l lead_ms] capture.pcapng\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int option;
+  int tx_class = SEATALK_TX_CLASS_DATA;
+  long lead_ms = 100;
+  int file;
+  struct stat file_status;
+  void *capture;
+  struct datagram *datagrams;
+  long count;
+  int device;
+  struct seatalk_command_filter none;
+  struct seatalk_completion_ring *ring;
+  struct seatalk_tx_request requests[SEATALK_TX_BATCH_MAX];
+  struct seatalk_tx_batch batch;
+  struct pollfd poll_device;
+  uint64_t base_ns;
+  uint64_t *errors;
+  long submitted = 0;
+  long completed = 0;
+  long sent = 0;
+  long failed = 0;
+  long in_flight = 0;
+  uint32_t tail;
+  uint32_t overruns = 0;
+  uint64_t error_total = 0;
+  const struct seatalk_tx_completion *completion;
+  int i;
+
+  while ((option = getopt(argc, argv, "c:l:")) != -1) {
+    switch (option) {
+    case 'c':
+      tx_class = atoi(optarg);
+      break;
+    case 'l':
+      lead_ms = atol(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  file = open(argv[optind], O_RDONLY);
+  if (file < 0 || fstat(file, &file_status)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  capture = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  if (capture == MAP_FAILED) {
+    perror(argv[optind]);
+    return 1;
+  }
+  count = load_datagrams(capture, file_status.st_size, &datagrams);
+  if (count < 0) {
+    fprintf(stderr, "%s: not a readable SeaTalk capture\n", argv[optind]);
+    return 1;
+  }
+  if (!count) {
+    fprintf(stderr, "%s: no datagrams\n", argv[optind]);
+    return 1;
+  }
+  errors = calloc(count, sizeof(*errors));
+  if (!errors) {
+    perror("calloc");
+    return 1;
+  }
+
+  device = open("/dev/seatalk", O_RDWR);
+  if (device < 0) {
+    perror("/dev/seatalk");
+    return 1;
+  }
+  // only completions are wanted
+  memset(&none, 0, sizeof(none));
+  ioctl(device, SEATALK_IOC_SET_FILTER, &none);
+  ring = mmap(NULL, SEATALK_COMPLETION_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, device, SEATALK_MMAP_COMPLETION_OFFSET);
+  if (ring == MAP_FAILED) {
+    perror("completion ring");
+    return 1;
+  }
+  tail = ring->tail;
+
+  base_ns = monotonic_ns() + lead_ms * 1000000;
+  for (i = 0; i < count; i++) {
+    datagrams[i].target_ns += base_ns;
+  }
+  poll_device.fd = device;
+  poll_device.events = POLLPRI;
+  while (completed < count) {
+    // keep the driver's timed queue topped up
+    while (submitted < count && in_flight + SEATALK_TX_BATCH_MAX <= IN_FLIGHT) {
+      memset(requests, 0, sizeof(requests));
+      for (i = 0; i < SEATALK_TX_BATCH_MAX && submitted + i < count; i++) {
+        requests[i].cookie = submitted + i;
+        requests[i].target_ns = datagrams[submitted + i].target_ns;
+        requests[i].tx_class = tx_class;
+        requests[i].length = datagrams[submitted + i].length;
+        memcpy(requests[i].bytes, datagrams[submitted + i].bytes, datagrams[submitted + i].length);
+      }
+      batch.requests = (uintptr_t)requests;
+      batch.count = i;
+      // requests that were not queued have already been completed with an error
+      if (ioctl(device, SEATALK_IOC_SUBMIT, &batch)) {
+        perror("SEATALK_IOC_SUBMIT");
+        return 1;
+      }
+      submitted += i;
+      in_flight += i;
+    }
+    poll(&poll_device, 1, 1000);
+    while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+      completion = &ring->entries[tail % SEATALK_COMPLETION_ENTRIES];
+      if (completion->status) {
+        fprintf(stderr, "datagram %llu: %s\n", (unsigned long long)completion->cookie, strerror(-completion->status));
+        failed++;
+      } else {
+        // never early; the driver holds each one until its target
+        errors[sent] = completion->start_ns > datagrams[completion->cookie].target_ns ? completion->start_ns - datagrams[completion->cookie].target_ns : 0;
+        error_total += errors[sent];
+        sent++;
+      }
+      completed++;
+      in_flight--;
+      tail++;
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (ring->overruns != overruns) {
+      // cannot happen while IN_FLIGHT is below the ring size, but don't wait forever for lost completions
+      fprintf(stderr, "%u completions lost\n", ring->overruns - overruns);
+      completed += ring->overruns - overruns;
+      in_flight -= ring->overruns - overruns;
+      failed += ring->overruns - overruns;
+      overruns = ring->overruns;
+    }
+  }
+
+  printf("datagrams %ld\nsent %ld\nfailed %ld\n", count, sent, failed);
+  if (sent) {
+    qsort(errors, sent, sizeof(*errors), compare_u64);
+    printf("schedule_error_mean_us %.1f\n", error_total / 1000.0 / sent);
+    printf("schedule_error_median_us %.1f\n", errors[sent / 2] / 1000.0);
+    printf("schedule_error_p99_us %.1f\n", errors[sent * 99 / 100] / 1000.0);
+    printf("schedule_error_max_us %.1f\n", errors[sent - 1] / 1000.0);
+  }
+  return failed ? 1 : 0;
+}